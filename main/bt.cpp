@@ -12,6 +12,9 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
+#include <esp_timer.h>
+#include <esp_pthread.h>
+
 #include <nimble/nimble_port_freertos.h>
 #include <nimble/nimble_port.h>
 #include <store/config/ble_store_config.h>
@@ -23,6 +26,8 @@
 #include <format>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <vector>
 
 extern "C" void ble_store_config_init();
 
@@ -137,6 +142,20 @@ BT::BT(Log &log_in, Config &config_in) : log(log_in), config(config_in)
 	this->stats_received_incomplete_packets = 0;
 	this->stats_indication_error = 0;
 	this->stats_indication_timeout = 0;
+	this->stats_control_invalid = 0;
+	this->stats_notify_enabled = 0;
+	this->stats_notify_replies = 0;
+	this->stats_notify_segments = 0;
+	this->stats_notify_bytes = 0;
+	this->stats_notify_acks = 0;
+	this->stats_notify_ack_timeouts = 0;
+	this->stats_notify_retransmits = 0;
+	this->stats_notify_errors = 0;
+	this->stats_notify_failed = 0;
+	this->stats_notify_dropped = 0;
+	this->stats_notify_time_us = 0;
+
+	this->notify_pending = false;
 
 	running = false;
 
@@ -145,9 +164,25 @@ BT::BT(Log &log_in, Config &config_in) : log(log_in), config(config_in)
 
 void BT::run()
 {
+	esp_err_t rv;
+	esp_pthread_cfg_t thread_config = esp_pthread_get_default_config();
+
 	if(running)
 		throw(hard_exception("BT::run: already running"));
 
+	thread_config.thread_name = "bt notify";
+	thread_config.pin_to_core = 1;
+	thread_config.stack_size = 3 * 1024;
+	thread_config.prio = 1;
+	thread_config.stack_alloc_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+
+	if((rv = esp_pthread_set_cfg(&thread_config)) != ESP_OK)
+		throw(hard_exception(this->log.esp_string_error(rv, "esp_pthread_set_cfg")));
+
+	std::thread notify_thread([this]() { this->run_notify(); });
+
+	notify_thread.detach();
+
 	::nimble_port_freertos_init(this->nimble_port_task);
 
 	running = true;
@@ -286,6 +321,12 @@ int BT::gap_event(struct ble_gap_event *event, void *arg)
 
 		case(BLE_GAP_EVENT_DISCONNECT):
 		{
+			{
+				std::scoped_lock lock(this->notify_mutex);
+				this->notify_state.erase(event->disconnect.conn.conn_handle);
+				this->notify_wake();
+			}
+
 			this->server_advertise();
 
 			break;
@@ -469,7 +510,11 @@ void BT::received(unsigned int connection_handle, unsigned int attribute_handle,
 
 	if(!Packet::valid(decrypt_buffer))
 	{
-		this->stats_received_invalid_packets++;
+		if(!decrypt_buffer.empty() && (static_cast<std::uint8_t>(decrypt_buffer[0]) == control_marker))
+			this->control(connection_handle, attribute_handle, decrypt_buffer);
+		else
+			this->stats_received_invalid_packets++;
+
 		return;
 	}
 
@@ -479,29 +524,114 @@ void BT::received(unsigned int connection_handle, unsigned int attribute_handle,
 		return;
 	}
 
-	command_response_t *command_response = new command_response_t;
+	command_response_t *command_response = command->response_pool_get();
 
 	command_response->source = cli_source_bt;
 	command_response->packetised = 1;
-	command_response->mtu = bt_mtu;
 	command_response->packet = decrypt_buffer;
+
+	{
+		std::scoped_lock lock(this->notify_mutex);
+		command_response->mtu = this->notify_state.contains(connection_handle) ? bt_notify_mtu : bt_mtu;
+	}
+
 	command_response->bt.connection_handle = connection_handle;
 	command_response->bt.attribute_handle = attribute_handle;
 
-	command->receive_queue_push(command_response);
+	command->receive_queue_push(command_response, false);
 
 	command_response = nullptr;
 }
 
-void BT::send(const command_response_t *command_response)
+void BT::control(unsigned int connection_handle, unsigned int attribute_handle, const std::string &message)
 {
-	struct os_mbuf *txom;
-	std::string encrypt_buffer;
-	int attempt, rv;
+	std::string reply, encrypt_buffer;
+	unsigned int window;
+
+	if(message.size() < 2)
+	{
+		this->stats_control_invalid++;
+		return;
+	}
+
+	switch(static_cast<std::uint8_t>(message[1]))
+	{
+		case(control_notify):
+		{
+			window = (message.size() > 2) ? static_cast<std::uint8_t>(message[2]) : notify_window_default;
+			window = std::clamp(window, 1U, notify_window_max);
+
+			// when already in notification mode, only the window changes, queued replies and the sequence carry on
+
+			{
+				std::scoped_lock lock(this->notify_mutex);
+				auto it = this->notify_state.find(connection_handle);
+
+				if(it == this->notify_state.end())
+					this->notify_state[connection_handle] = { .window = window, .sequence_next = 0, .sequence_acked = 0, .replies = {} };
+				else
+					it->second.window = window;
+
+				this->notify_wake();
+			}
+
+			this->stats_notify_enabled++;
+
+			reply = { static_cast<char>(control_marker), static_cast<char>(control_notify), static_cast<char>(window) };
+			break;
+		}
+
+		case(control_indicate):
+		{
+			{
+				std::scoped_lock lock(this->notify_mutex);
+				auto it = this->notify_state.find(connection_handle);
+
+				if(it != this->notify_state.end())
+				{
+					this->stats_notify_dropped += it->second.replies.size();
+					this->notify_state.erase(it);
+				}
+
+				this->notify_wake();
+			}
+
+			reply = { static_cast<char>(control_marker), static_cast<char>(control_indicate) };
+			break;
+		}
+
+		case(control_ack):
+		{
+			if(message.size() != 4)
+			{
+				this->stats_control_invalid++;
+				return;
+			}
+
+			{
+				std::scoped_lock lock(this->notify_mutex);
+				auto it = this->notify_state.find(connection_handle);
+
+				if(it != this->notify_state.end())
+					it->second.sequence_acked = static_cast<std::uint8_t>(message[2]) | (static_cast<std::uint8_t>(message[3]) << 8);
+
+				this->notify_wake();
+			}
+
+			this->stats_notify_acks++;
+			return;
+		}
+
+		default:
+		{
+			this->stats_control_invalid++;
+			return;
+		}
+	}
 
 	try
 	{
-		encrypt_buffer = Crypt::aes256(true, Crypt::password_to_aes256_key(encryption_key), command_response->packet);
+		encrypt_buffer = Crypt::aes256(true, Crypt::password_to_aes256_key(encryption_key), reply);
 	}
 	catch(const hard_exception &e)
 	{
@@ -509,14 +639,31 @@ void BT::send(const command_response_t *command_response)
 		return;
 	}
 
-	for(attempt = 16; attempt > 0; attempt--)
+	std::scoped_lock lock(this->notify_mutex);
+
+	if(this->control_replies.size() >= notify_queue_max)
 	{
-		txom = ble_hs_mbuf_from_flat(encrypt_buffer.data(), encrypt_buffer.size());
+		this->stats_notify_dropped++;
+		return;
+	}
 
-		if(!txom)
-			throw(hard_exception("BT::send: invalid mbuf"));
+	this->control_replies.push_back({ .connection_handle = connection_handle, .attribute_handle = attribute_handle, .data = std::move(encrypt_buffer) });
+	this->notify_wake();
+}
 
-		rv = ble_gatts_indicate_custom(command_response->bt.connection_handle, command_response->bt.attribute_handle, txom);
+bool BT::indicate(unsigned int connection_handle, unsigned int attribute_handle, const std::string &data)
+{
+	struct os_mbuf *txom;
+	int attempt, rv;
+
+	for(attempt = 16; attempt > 0; attempt--)
+	{
+		// the msys pool runs out under load, just like the transmit queue, so retry in both cases
+
+		if(!(txom = ble_hs_mbuf_from_flat(data.data(), data.size())))
+			rv = BLE_HS_ENOMEM;
+		else
+			rv = ble_gatts_indicate_custom(connection_handle, attribute_handle, txom);
 
 		if(rv == 0)
 			break;
@@ -525,7 +672,7 @@ void BT::send(const command_response_t *command_response)
 		{
 			this->stats_indication_error++;
 			log << std::format("bt: send error: {:#x}", rv);
-			return;
+			return(false);
 		}
 		else
 			log << "bt: HS_ENOMEM";
@@ -538,9 +685,288 @@ void BT::send(const command_response_t *command_response)
 	if(attempt == 0)
 	{
 		this->stats_indication_timeout++;
+		return(false);
+	}
+
+	return(true);
+}
+
+bool BT::notify_segment(unsigned int connection_handle, unsigned int attribute_handle, unsigned int sequence, bool first, bool last, const char *data, unsigned int length)
+{
+	std::uint8_t header[notify_segment_header_size];
+	struct os_mbuf *txom;
+	int attempt, rv;
+
+	header[0] = (sequence >> 0) & 0xff;
+	header[1] = (sequence >> 8) & 0xff;
+	header[2] = (first ? notify_segment_flag_first : 0) | (last ? notify_segment_flag_last : 0);
+
+	for(attempt = 16; attempt > 0; attempt--)
+	{
+		if(!(txom = ble_hs_mbuf_from_flat(header, sizeof(header))))
+			rv = BLE_HS_ENOMEM;
+		else if(os_mbuf_append(txom, data, length) != 0)
+		{
+			os_mbuf_free_chain(txom);
+			rv = BLE_HS_ENOMEM;
+		}
+		else
+			rv = ble_gatts_notify_custom(connection_handle, attribute_handle, txom);
+
+		if(rv == 0)
+			break;
+
+		if(rv != BLE_HS_ENOMEM)
+		{
+			this->stats_notify_errors++;
+			return(false);
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	if(attempt == 0)
+	{
+		this->stats_notify_errors++;
+		return(false);
+	}
+
+	this->stats_notify_segments++;
+
+	return(true);
+}
+
+// notify_mutex must be held
+
+void BT::notify_wake()
+{
+	this->notify_pending = true;
+	this->notify_condition.notify_all();
+}
+
+// Replies in notification mode are sent by the "bt notify" thread, so the command send thread never waits for
+// a client's acknowledgements. Per connection, segments of the front reply are sent until the window is full,
+// further segments go out when an acknowledgement wakes the thread. When none arrives in time,
+// all unacknowledged segments are sent again (go back N). The lock is released while a segment is sent,
+// the connection may have gone (or switched mode) meanwhile, so its state is looked up again afterwards.
+
+void BT::notify_service(unsigned int connection_handle, std::unique_lock<std::mutex> &lock, std::int64_t &next)
+{
+	std::map<unsigned int, notify_state_t>::iterator it;
+	std::shared_ptr<const std::string> data;
+	unsigned int attribute_handle, sequence, offset, length, value;
+	std::int64_t now;
+	bool first, last, sent;
+
+	for(;;)
+	{
+		if(((it = this->notify_state.find(connection_handle)) == this->notify_state.end()) || it->second.replies.empty())
+			return;
+
+		notify_state_t &state = it->second;
+		notify_reply_t &reply = state.replies.front();
+
+		now = esp_timer_get_time();
+
+		if(!reply.started)
+		{
+			reply.started = true;
+			reply.base = state.sequence_next;
+			reply.index = 0;
+			reply.acked = 0;
+			reply.retries = 0;
+			reply.deadline = 0;
+			reply.time_start = now;
+			state.sequence_next = (reply.base + reply.segments) & 0xffff;
+		}
+
+		value = (state.sequence_acked - reply.base) & 0xffff;
+
+		if((value <= reply.segments) && (value > reply.acked)) // otherwise an acknowledgement from before this reply
+		{
+			reply.acked = value;
+			reply.index = std::max(reply.index, reply.acked);
+			reply.retries = 0;
+			reply.deadline = (reply.index > reply.acked) ? now + (notify_ack_timeout_ms * 1000LL) : 0;
+		}
+
+		if(reply.acked >= reply.segments)
+		{
+			this->stats_notify_replies++;
+			this->stats_notify_bytes += reply.data->size();
+			this->stats_notify_time_us += now - reply.time_start;
+			this->stats_sent_bytes += reply.size;
+			this->stats_sent_packets++;
+			state.replies.pop_front();
+			continue;
+		}
+
+		if(reply.deadline && (now >= reply.deadline))
+		{
+			this->stats_notify_ack_timeouts++;
+
+			if(++reply.retries > notify_retries_max)
+			{
+				this->stats_notify_failed++;
+				state.sequence_next = (reply.base + reply.acked) & 0xffff;
+				state.replies.pop_front();
+				continue;
+			}
+
+			this->stats_notify_retransmits += reply.index - reply.acked;
+			reply.index = reply.acked;
+			reply.deadline = 0;
+		}
+
+		if((reply.index >= reply.segments) || ((reply.index - reply.acked) >= state.window))
+		{
+			if(reply.deadline && (reply.deadline < next))
+				next = reply.deadline;
+
+			return;
+		}
+
+		data = reply.data;
+		attribute_handle = reply.attribute_handle;
+		sequence = (reply.base + reply.index) & 0xffff;
+		first = reply.index == 0;
+		last = reply.index == (reply.segments - 1);
+		offset = reply.index * reply.segment_size;
+		length = std::min(static_cast<unsigned int>(data->size()) - offset, reply.segment_size);
+
+		lock.unlock();
+		sent = this->notify_segment(connection_handle, attribute_handle, sequence, first, last, data->data() + offset, length);
+		lock.lock();
+
+		if(((it = this->notify_state.find(connection_handle)) == this->notify_state.end()) ||
+				it->second.replies.empty() || (it->second.replies.front().data != data))
+			continue;
+
+		notify_reply_t &current = it->second.replies.front();
+
+		if(!sent)
+		{
+			this->stats_notify_failed++;
+			it->second.sequence_next = (current.base + current.acked) & 0xffff;
+			it->second.replies.pop_front();
+			continue;
+		}
+
+		current.index++;
+		current.deadline = esp_timer_get_time() + (notify_ack_timeout_ms * 1000LL);
+	}
+}
+
+// Control confirmations are queued here too instead of being sent from the GATT access callback,
+// indicating from there could sleep and retry within the NimBLE host task.
+
+void BT::run_notify()
+{
+	std::vector<unsigned int> connections;
+	control_reply_t control_reply;
+	std::int64_t next, delay;
+
+	try
+	{
+		std::unique_lock lock(this->notify_mutex);
+
+		for(;;)
+		{
+			this->notify_pending = false;
+
+			while(!this->control_replies.empty())
+			{
+				control_reply = std::move(this->control_replies.front());
+				this->control_replies.pop_front();
+
+				lock.unlock();
+				this->indicate(control_reply.connection_handle, control_reply.attribute_handle, control_reply.data);
+				lock.lock();
+			}
+
+			next = esp_timer_get_time() + (notify_idle_ms * 1000LL);
+
+			connections.clear();
+
+			for(const auto &entry : this->notify_state)
+				connections.push_back(entry.first);
+
+			for(const auto connection_handle : connections)
+				this->notify_service(connection_handle, lock, next);
+
+			delay = std::max(next - esp_timer_get_time(), static_cast<std::int64_t>(0));
+
+			this->notify_condition.wait_for(lock, std::chrono::microseconds(delay), [this]() { return(this->notify_pending); });
+		}
+	}
+	catch(const hard_exception &e)
+	{
+		this->log.abort(std::format("bt notify thread: hard exception: {}", e.what()).c_str());
+	}
+	catch(const transient_exception &e)
+	{
+		this->log.abort(std::format("bt notify thread: transient exception: {}", e.what()).c_str());
+	}
+	catch(const std::exception &e)
+	{
+		this->log.abort(std::format("bt notify thread: standard exception: {}", e.what()).c_str());
+	}
+	catch(...)
+	{
+		this->log.abort("bt notify thread: unknown exception");
+	}
+
+	for(;;)
+		(void)0;
+}
+
+void BT::send(const command_response_t *command_response)
+{
+	std::string encrypt_buffer;
+	std::map<unsigned int, notify_state_t>::iterator it;
+	notify_reply_t reply;
+	unsigned int att_mtu;
+
+	try
+	{
+		encrypt_buffer = Crypt::aes256(true, Crypt::password_to_aes256_key(encryption_key), command_response->packet);
+	}
+	catch(const hard_exception &e)
+	{
+		this->stats_sent_encryption_failed++;
 		return;
 	}
 
+	att_mtu = std::max(static_cast<unsigned int>(ble_att_mtu(command_response->bt.connection_handle)), static_cast<unsigned int>(BLE_ATT_MTU_DFLT));
+
+	{
+		std::scoped_lock lock(this->notify_mutex);
+
+		if((it = this->notify_state.find(command_response->bt.connection_handle)) != this->notify_state.end())
+		{
+			if(it->second.replies.size() >= notify_queue_max)
+			{
+				this->stats_notify_dropped++;
+				return;
+			}
+
+			reply.attribute_handle = command_response->bt.attribute_handle;
+			reply.size = command_response->packet.size();
+			reply.segment_size = att_mtu - 3 - notify_segment_header_size; // 3 = ATT notification header
+			reply.segments = std::max((static_cast<unsigned int>(encrypt_buffer.size()) + reply.segment_size - 1) / reply.segment_size, 1U);
+			reply.data = std::make_shared<const std::string>(std::move(encrypt_buffer));
+			reply.started = false;
+
+			it->second.replies.push_back(std::move(reply));
+			this->notify_wake();
+
+			return;
+		}
+	}
+
+	if(!this->indicate(command_response->bt.connection_handle, command_response->bt.attribute_handle, encrypt_buffer))
+		return;
+
 	this->stats_sent_bytes += command_response->packet.size();
 	this->stats_sent_packets++;
 }
@@ -549,8 +975,8 @@ void BT::info(std::string &out)
 {
 	out += std::format("\n  address: {}", System::get().mac_addr_to_string(reinterpret_cast<const char *>(bt_host_address), true)); // FIXME
 	out += "\n  data sent:";
-	out += std::format("\n  - packets: {:d}", this->stats_sent_packets);
-	out += std::format("\n  - bytes: {:d}", this->stats_sent_bytes);
+	out += std::format("\n  - packets: {:d}", this->stats_sent_packets.load());
+	out += std::format("\n  - bytes: {:d}", this->stats_sent_bytes.load());
 	out += std::format("\n  - encryption failed: {:d}", this->stats_sent_encryption_failed);
 	out += "\n  data received:";
 	out += std::format("\n  - bytes: {:d}", this->stats_received_bytes);
@@ -562,6 +988,30 @@ void BT::info(std::string &out)
 	out += "\n  indications:";
 	out += std::format("\n  - errors: {:d}", this->stats_indication_error);
 	out += std::format("\n  - timeouts: {:d}", this->stats_indication_timeout);
+	out += "\n  notifications:";
+
+	{
+		std::scoped_lock lock(this->notify_mutex);
+		unsigned int queued = 0;
+
+		for(const auto &entry : this->notify_state)
+			queued += entry.second.replies.size();
+
+		out += std::format("\n  - connections in notification mode: {:d}, enabled: {:d}", this->notify_state.size(), this->stats_notify_enabled);
+		out += std::format("\n  - replies queued: {:d}", queued);
+	}
+
+	out += std::format("\n  - replies: {:d}", this->stats_notify_replies);
+	out += std::format("\n  - segments: {:d}", this->stats_notify_segments);
+	out += std::format("\n  - bytes: {:d}", this->stats_notify_bytes);
+	out += std::format("\n  - throughput: {:d} bytes/s", (this->stats_notify_time_us > 0) ? (this->stats_notify_bytes * 1000000LL) / this->stats_notify_time_us : 0);
+	out += std::format("\n  - acknowledgements: {:d}", this->stats_notify_acks);
+	out += std::format("\n  - acknowledgement timeouts: {:d}", this->stats_notify_ack_timeouts);
+	out += std::format("\n  - retransmitted segments: {:d}", this->stats_notify_retransmits);
+	out += std::format("\n  - errors: {:d}", this->stats_notify_errors);
+	out += std::format("\n  - failed replies: {:d}", this->stats_notify_failed);
+	out += std::format("\n  - dropped replies: {:d}", this->stats_notify_dropped);
+	out += std::format("\n  control messages invalid: {:d}", this->stats_control_invalid);
 }
 
 void BT::key(const std::string &ekey)
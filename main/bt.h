@@ -5,6 +5,12 @@
 
 #include <string>
 #include <cstdint>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 class Command;
 
@@ -31,6 +37,60 @@ class BT final
 		static constexpr int characteristics_handle = 0xabf1;
 		static constexpr int bt_mtu = 484;
 
+		// A client can switch a connection to notification mode by writing a control message, which is
+		// encrypted like a request: marker, 'N', window (1). Replies are then sent as notifications of
+		// header (sequence (2) little endian, flags (1)) and a segment of the encrypted reply. The client
+		// acknowledges with marker, 'A', next expected sequence (2) at least every window segments and
+		// after the last segment. Marker, 'I' switches back to indications.
+		// The first segment of every reply is flagged, so a client can drop a partial reply and resync.
+		// When a reply fails, the next one continues from the last acknowledged sequence number.
+
+		static constexpr int bt_notify_mtu = 4096;
+		static constexpr unsigned int control_marker = 0x03;
+		static constexpr unsigned int control_notify = 'N';
+		static constexpr unsigned int control_indicate = 'I';
+		static constexpr unsigned int control_ack = 'A';
+		static constexpr unsigned int notify_window_default = 8;
+		static constexpr unsigned int notify_window_max = 32;
+		static constexpr unsigned int notify_segment_header_size = 3;
+		static constexpr unsigned int notify_segment_flag_last = 0x01;
+		static constexpr unsigned int notify_segment_flag_first = 0x02;
+		static constexpr int notify_ack_timeout_ms = 500;
+		static constexpr unsigned int notify_retries_max = 3;
+		static constexpr unsigned int notify_queue_max = 8;
+		static constexpr int notify_idle_ms = 1000;
+
+		struct notify_reply_t
+		{
+			std::shared_ptr<const std::string> data; // encrypted
+			unsigned int attribute_handle;
+			unsigned int size; // unencrypted, for the statistics
+			unsigned int segment_size;
+			unsigned int segments;
+			bool started;
+			unsigned int base;
+			unsigned int index; // next segment to send
+			unsigned int acked;
+			unsigned int retries;
+			std::int64_t deadline; // for an acknowledgement of the segments sent, 0 = none outstanding
+			std::int64_t time_start;
+		};
+
+		struct notify_state_t
+		{
+			unsigned int window;
+			unsigned int sequence_next;
+			unsigned int sequence_acked;
+			std::deque<notify_reply_t> replies; // the front one is being sent
+		};
+
+		struct control_reply_t
+		{
+			unsigned int connection_handle;
+			unsigned int attribute_handle;
+			std::string data;
+		};
+
 		static BT *singleton;
 		Log &log;
 		Config &config;
@@ -40,6 +100,12 @@ class BT final
 		std::string encryption_key;
 		bool running;
 
+		std::map<unsigned int, notify_state_t> notify_state; // per connection handle
+		std::deque<control_reply_t> control_replies;
+		std::mutex notify_mutex;
+		std::condition_variable notify_condition;
+		bool notify_pending;
+
 		static void nimble_port_task(void *);
 
 		static int gatt_value_event_wrapper(std::uint16_t connection_handle, std::uint16_t attribute_handle, struct ble_gatt_access_ctxt *context, void *arg);
@@ -61,8 +127,8 @@ class BT final
 		std::uint16_t value_attribute_handle;
 		std::uint8_t own_addr_type;
 
-		int stats_sent_bytes;
-		int stats_sent_packets;
+		std::atomic<int> stats_sent_bytes; // updated by both the cmd send and bt notify threads
+		std::atomic<int> stats_sent_packets;
 		int stats_sent_encryption_failed;
 		int stats_received_bytes;
 		int stats_received_packets;
@@ -72,8 +138,26 @@ class BT final
 		int stats_received_incomplete_packets;
 		int stats_indication_error;
 		int stats_indication_timeout;
+		int stats_control_invalid;
+		int stats_notify_enabled;
+		int stats_notify_replies;
+		int stats_notify_segments;
+		int stats_notify_bytes;
+		int stats_notify_acks;
+		int stats_notify_ack_timeouts;
+		int stats_notify_retransmits;
+		int stats_notify_errors;
+		int stats_notify_failed;
+		int stats_notify_dropped;
+		std::int64_t stats_notify_time_us;
 
 		int gatt_init();
 		void server_advertise();
 		void received(unsigned int connection_handle, unsigned int attribute_handle, const struct os_mbuf *mbuf);
+		void control(unsigned int connection_handle, unsigned int attribute_handle, const std::string &message);
+		bool indicate(unsigned int connection_handle, unsigned int attribute_handle, const std::string &data);
+		bool notify_segment(unsigned int connection_handle, unsigned int attribute_handle, unsigned int sequence, bool first, bool last, const char *data, unsigned int length);
+		void notify_wake();
+		void notify_service(unsigned int connection_handle, std::unique_lock<std::mutex> &lock, std::int64_t &next);
+		[[noreturn]] void run_notify();
 };
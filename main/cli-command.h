@@ -1,6 +1,9 @@
 #pragma once
 
+#include "command-response.h"
+
 #include <string>
+#include <functional>
 
 enum
 {
@@ -33,6 +36,61 @@ typedef struct
 	std::string str;
 } cli_parameter_t;
 
+struct cli_unsigned_int_description_t
+{
+	unsigned int lower_bound;
+	unsigned int upper_bound;
+};
+
+struct cli_signed_int_description_t
+{
+	int lower_bound;
+	int upper_bound;
+};
+
+struct cli_float_description_t
+{
+	float lower_bound;
+	float upper_bound;
+};
+
+struct cli_string_description_t
+{
+	unsigned int lower_length_bound;
+	unsigned int upper_length_bound;
+};
+
+struct cli_parameter_description_t
+{
+	cli_parameter_type_description_t type:4;
+
+	unsigned int base:5;
+	unsigned int value_required:1;
+	unsigned int lower_bound_required:1;
+	unsigned int upper_bound_required:1;
+
+	const char *description;
+
+	union
+	{
+		cli_unsigned_int_description_t	unsigned_int;
+		cli_signed_int_description_t	signed_int;
+		cli_float_description_t			fp;
+		cli_string_description_t		string;
+	};
+};
+
+struct cli_parameters_description_t
+{
+	unsigned int count;
+	cli_parameter_description_t entries[parameters_size];
+};
+
+// Set when a command runs as a background job, commands that take long can report their progress (in percent) through it.
+// It throws a transient_exception when the job has been cancelled.
+
+typedef std::function<void(unsigned int percent)> cli_progress_function_t;
+
 typedef struct
 {
 	cli_source_t		source;
@@ -42,6 +100,8 @@ typedef struct
 	std::string			oob;
 	std::string			result;
 	std::string			result_oob;
+	std::string			request_id;
+	cli_progress_function_t	progress;
 } cli_command_call_t;
 
 typedef void(cli_command_function_t)(cli_command_call_t *);
@@ -0,0 +1,355 @@
+#include "cli-parser.h"
+#include "exception.h"
+
+#include <string>
+#include <string_view>
+#include <format>
+#include <bit>
+#include <limits>
+
+void CliParser::set_unsigned_int(const cli_parameter_description_t &description, cli_parameter_t &parameter, unsigned int value)
+{
+	if((description.lower_bound_required) && (value < description.unsigned_int.lower_bound))
+		throw(transient_exception(std::format("ERROR: invalid unsigned integer value: {:d}, smaller than lower bound: {:d}",
+				value, description.unsigned_int.lower_bound)));
+
+	if((description.upper_bound_required) && (value > description.unsigned_int.upper_bound))
+		throw(transient_exception(std::format("ERROR: invalid unsigned integer value: {:d}, larger than upper bound: {:d}",
+				value, description.unsigned_int.upper_bound)));
+
+	parameter.type = cli_parameter_unsigned_int;
+	parameter.has_value = 1;
+	parameter.unsigned_int = value;
+}
+
+void CliParser::set_signed_int(const cli_parameter_description_t &description, cli_parameter_t &parameter, int value)
+{
+	if((description.lower_bound_required) && (value < description.signed_int.lower_bound))
+		throw(transient_exception(std::format("ERROR: invalid signed integer value: {:d}, smaller than lower bound: {:d}",
+				value, description.signed_int.lower_bound)));
+
+	if((description.upper_bound_required) && (value > description.signed_int.upper_bound))
+		throw(transient_exception(std::format("ERROR: invalid signed integer value: {:d}, larger than upper bound: {:d}",
+				value, description.signed_int.upper_bound)));
+
+	parameter.type = cli_parameter_signed_int;
+	parameter.has_value = 1;
+	parameter.signed_int = value;
+}
+
+void CliParser::set_float(const cli_parameter_description_t &description, cli_parameter_t &parameter, float value)
+{
+	if((description.lower_bound_required) && (value < description.fp.lower_bound))
+		throw(transient_exception(std::format("ERROR: invalid float value: {:f}, smaller than lower bound: {:f}",
+				value, description.fp.lower_bound)));
+
+	if((description.upper_bound_required) && (value > description.fp.upper_bound))
+		throw(transient_exception(std::format("ERROR: invalid float value: {:f}, larger than upper bound: {:f}",
+				value, description.fp.upper_bound)));
+
+	parameter.type = cli_parameter_float;
+	parameter.has_value = 1;
+	parameter.fp = value;
+}
+
+void CliParser::set_string(const cli_parameter_description_t &description, cli_parameter_t &parameter)
+{
+	unsigned int length;
+	std::string_view kind;
+
+	length = parameter.str.length();
+	kind = (description.type == cli_parameter_string_raw) ? "raw string" : "string";
+
+	if((description.lower_bound_required) && (length < description.string.lower_length_bound))
+		throw(transient_exception(std::format("ERROR: invalid {} length: {:d}, smaller than lower bound: {:d}",
+				kind, length, description.string.lower_length_bound)));
+
+	if((description.upper_bound_required) && (length > description.string.upper_length_bound))
+		throw(transient_exception(std::format("ERROR: invalid {} length: {:d}, larger than upper bound: {:d}",
+				kind, length, description.string.upper_length_bound)));
+
+	parameter.type = cli_parameter_string;
+	parameter.has_value = 1;
+}
+
+std::string::const_iterator CliParser::command(const std::string &line, std::string &command)
+{
+	std::string::const_iterator line_iterator;
+
+	command.clear();
+
+	for(line_iterator = line.begin(); line_iterator != line.end(); line_iterator++)
+		if(*line_iterator > ' ')
+			command.append(1, *line_iterator);
+		else
+			break;
+
+	return(line_iterator);
+}
+
+void CliParser::parameters(const cli_parameters_description_t &description, const std::string &line,
+		std::string::const_iterator line_iterator, cli_command_call_t &call)
+{
+	unsigned int count, current;
+	cli_parameter_t *parameter;
+	const cli_parameter_description_t *parameter_description;
+
+	call.parameter_count = 0;
+
+	count = description.count;
+
+	if(count > parameters_size)
+		throw(hard_exception("CliParser::parameters: parameter count > parameters_size"));
+
+	for(current = 0; current < count; current++)
+	{
+		parameter_description = &description.entries[current];
+		parameter = &call.parameters[current];
+
+		parameter->type = cli_parameter_none;
+		parameter->has_value = 0;
+
+		for(; line_iterator != line.end(); line_iterator++)
+			if(*line_iterator > ' ')
+				break;
+
+		if(line_iterator == line.end())
+		{
+			if(!parameter_description->value_required)
+				continue;
+			else
+				throw(transient_exception(std::format("ERROR: missing required parameter {:d}", current + 1)));
+		}
+		else
+		{
+			call.parameter_count++;
+
+			parameter->str.clear();
+
+			for(; line_iterator != line.end(); line_iterator++)
+				if(*line_iterator > ' ')
+					parameter->str.append(1, *line_iterator);
+				else
+					break;
+
+			switch(parameter_description->type)
+			{
+				case(cli_parameter_none):
+				case(cli_parameter_size):
+				{
+					throw(transient_exception(std::format("ERROR: parameter with invalid type {:d}", static_cast<int>(parameter_description->type))));
+				}
+
+				case(cli_parameter_unsigned_int):
+				{
+					unsigned long long value;
+
+					// convert wide and check explicitly, so values out of 32 bit range are rejected on 64 bit hosts too
+
+					try
+					{
+						value = std::stoull(parameter->str, nullptr, parameter_description->base);
+					}
+					catch(...)
+					{
+						throw(transient_exception(std::format("ERROR: invalid unsigned integer value: {}", parameter->str)));
+					}
+
+					if(value > std::numeric_limits<unsigned int>::max())
+						throw(transient_exception(std::format("ERROR: invalid unsigned integer value: {}", parameter->str)));
+
+					set_unsigned_int(*parameter_description, *parameter, static_cast<unsigned int>(value));
+
+					break;
+				}
+
+				case(cli_parameter_signed_int):
+				{
+					long long value;
+
+					try
+					{
+						value = std::stoll(parameter->str, nullptr, parameter_description->base);
+					}
+					catch(...)
+					{
+						throw(transient_exception(std::format("ERROR: invalid signed integer value: {}", parameter->str)));
+					}
+
+					if((value < std::numeric_limits<int>::min()) || (value > std::numeric_limits<int>::max()))
+						throw(transient_exception(std::format("ERROR: invalid signed integer value: {}", parameter->str)));
+
+					set_signed_int(*parameter_description, *parameter, static_cast<int>(value));
+
+					break;
+				}
+
+				case(cli_parameter_float):
+				{
+					float value;
+
+					try
+					{
+						value = std::stod(parameter->str, nullptr);
+					}
+					catch(...)
+					{
+						throw(transient_exception(std::format("ERROR: invalid float value: {}", parameter->str)));
+					}
+
+					set_float(*parameter_description, *parameter, value);
+
+					break;
+				}
+
+				case(cli_parameter_string):
+				{
+					set_string(*parameter_description, *parameter);
+
+					break;
+				}
+
+				case(cli_parameter_string_raw):
+				{
+					for(; line_iterator != line.end(); line_iterator++)
+						parameter->str.append(1, *line_iterator);
+
+					set_string(*parameter_description, *parameter);
+
+					break;
+				}
+			}
+		}
+	}
+
+	if(current >= parameters_size)
+		throw(transient_exception(std::format("ERROR: too many parameters: {}", current)));
+
+	if(current < description.count)
+		throw(transient_exception("ERROR: missing parameters"));
+
+	for(; line_iterator != line.end(); line_iterator++)
+		if(*line_iterator > ' ')
+			break;
+
+	if(line_iterator != line.end())
+		throw(transient_exception("ERROR: too many parameters"));
+}
+
+bool CliParser::binary(const std::string &line)
+{
+	return((line.length() > 0) && (static_cast<unsigned char>(line[0]) == binary_marker));
+}
+
+unsigned int CliParser::get_le(const std::string &line, unsigned int &offset, unsigned int size)
+{
+	unsigned int ix, value;
+
+	if((offset + size) > line.length())
+		throw(transient_exception(std::format("ERROR: binary call truncated at offset {:d}", offset)));
+
+	for(ix = 0, value = 0; ix < size; ix++)
+		value |= static_cast<unsigned int>(static_cast<unsigned char>(line[offset + ix])) << (ix * 8);
+
+	offset += size;
+
+	return(value);
+}
+
+unsigned int CliParser::binary_command(const std::string &line, unsigned int &offset)
+{
+	offset = 1;
+
+	return(get_le(line, offset, 2));
+}
+
+void CliParser::parameters_binary(const cli_parameters_description_t &description, const std::string &line,
+		unsigned int offset, cli_command_call_t &call)
+{
+	unsigned int count, current, tag, value, length;
+	cli_parameter_t *parameter;
+	const cli_parameter_description_t *parameter_description;
+
+	call.parameter_count = 0;
+
+	if(description.count > parameters_size)
+		throw(hard_exception("CliParser::parameters_binary: parameter count > parameters_size"));
+
+	count = get_le(line, offset, 1);
+
+	if(count > description.count)
+		throw(transient_exception(std::format("ERROR: too many parameters: {:d}", count)));
+
+	for(current = 0; current < description.count; current++)
+	{
+		parameter_description = &description.entries[current];
+		parameter = &call.parameters[current];
+
+		parameter->type = cli_parameter_none;
+		parameter->has_value = 0;
+		parameter->str.clear();
+
+		if(current >= count)
+		{
+			if(parameter_description->value_required)
+				throw(transient_exception(std::format("ERROR: missing required parameter {:d}", current + 1)));
+
+			continue;
+		}
+
+		call.parameter_count++;
+
+		tag = get_le(line, offset, 1);
+
+		if((tag != static_cast<unsigned int>(parameter_description->type)) &&
+				!((tag == cli_parameter_string) && (parameter_description->type == cli_parameter_string_raw)))
+			throw(transient_exception(std::format("ERROR: parameter {:d}: type {:d} does not match expected type {:d}",
+					current + 1, tag, static_cast<int>(parameter_description->type))));
+
+		switch(parameter_description->type)
+		{
+			case(cli_parameter_none):
+			case(cli_parameter_size):
+			{
+				throw(transient_exception(std::format("ERROR: parameter with invalid type {:d}", static_cast<int>(parameter_description->type))));
+			}
+
+			case(cli_parameter_unsigned_int):
+			{
+				set_unsigned_int(*parameter_description, *parameter, get_le(line, offset, 4));
+				break;
+			}
+
+			case(cli_parameter_signed_int):
+			{
+				set_signed_int(*parameter_description, *parameter, static_cast<int>(get_le(line, offset, 4)));
+				break;
+			}
+
+			case(cli_parameter_float):
+			{
+				value = get_le(line, offset, 4);
+				set_float(*parameter_description, *parameter, std::bit_cast<float>(value));
+				break;
+			}
+
+			case(cli_parameter_string):
+			case(cli_parameter_string_raw):
+			{
+				length = get_le(line, offset, 2);
+
+				if((offset + length) > line.length())
+					throw(transient_exception(std::format("ERROR: binary call truncated at offset {:d}", offset)));
+
+				parameter->str.assign(line, offset, length);
+				offset += length;
+
+				set_string(*parameter_description, *parameter);
+				break;
+			}
+		}
+	}
+
+	if(offset != line.length())
+		throw(transient_exception(std::format("ERROR: {:d} trailing bytes after binary call", line.length() - offset)));
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "cli-command.h"
+
+#include <string>
+
+// Tokenising, bound checking and conversion of a command line against a command's parameter description.
+// Depends on nothing but the standard library and exception.h, so it can also be built and exercised on the host.
+//
+// Besides text, a call can be sent in binary form, identified by binary_marker as first byte:
+//   u8 marker, u16 command index, u8 parameter count, then for each parameter
+//   u8 type (cli_parameter_type_description_t), followed by the value:
+//   unsigned/signed int: 4 bytes, float: 4 bytes IEEE 754, string: u16 length + bytes.
+// All multi-byte values are little endian. Values are subject to the same bounds as text parameters.
+
+class CliParser final
+{
+	public:
+
+		static constexpr unsigned char binary_marker = 0x01;
+
+		CliParser() = delete;
+		CliParser(const CliParser &) = delete;
+
+		static std::string::const_iterator command(const std::string &line, std::string &command);
+		static void parameters(const cli_parameters_description_t &description, const std::string &line,
+				std::string::const_iterator line_iterator, cli_command_call_t &call);
+		static bool binary(const std::string &line);
+		static unsigned int binary_command(const std::string &line, unsigned int &offset);
+		static void parameters_binary(const cli_parameters_description_t &description, const std::string &line,
+				unsigned int offset, cli_command_call_t &call);
+
+	private:
+
+		static unsigned int get_le(const std::string &line, unsigned int &offset, unsigned int size);
+		static void set_unsigned_int(const cli_parameter_description_t &, cli_parameter_t &, unsigned int value);
+		static void set_signed_int(const cli_parameter_description_t &, cli_parameter_t &, int value);
+		static void set_float(const cli_parameter_description_t &, cli_parameter_t &, float value);
+		static void set_string(const cli_parameter_description_t &, cli_parameter_t &);
+};
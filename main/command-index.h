@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string_view>
+#include <array>
+#include <algorithm>
+#include <cstddef>
+
+// Compile-time sorted index over the names and aliases of a command table, looked up by binary search.
+// The table is terminated by an entry with name == nullptr, entries only need a name and an alias member.
+// Depends on nothing but the standard library, so it can also be built and benchmarked on the host.
+
+class CommandIndex final
+{
+	public:
+
+		struct entry_t
+		{
+			std::string_view key;
+			unsigned int command_index;
+		};
+
+		CommandIndex() = delete;
+		CommandIndex(const CommandIndex &) = delete;
+
+		template<typename command_t> static constexpr unsigned int size(const command_t *commands)
+		{
+			unsigned int command_index, rv;
+
+			for(command_index = 0, rv = 0; commands[command_index].name; command_index++)
+				rv += commands[command_index].alias ? 2 : 1;
+
+			return(rv);
+		}
+
+		template<unsigned int index_size, typename command_t> static constexpr std::array<entry_t, index_size> build(const command_t *commands)
+		{
+			std::array<entry_t, index_size> rv;
+			unsigned int command_index, entry;
+
+			for(command_index = 0, entry = 0; commands[command_index].name; command_index++)
+			{
+				rv[entry++] = { commands[command_index].name, command_index };
+
+				if(commands[command_index].alias)
+					rv[entry++] = { commands[command_index].alias, command_index };
+			}
+
+			std::sort(rv.begin(), rv.end(), [](const entry_t &a, const entry_t &b) { return(a.key < b.key); });
+
+			return(rv);
+		}
+
+		template<std::size_t index_size> static constexpr bool unique(const std::array<entry_t, index_size> &index)
+		{
+			return(std::adjacent_find(index.begin(), index.end(),
+					[](const entry_t &a, const entry_t &b) { return(a.key == b.key); }) == index.end());
+		}
+
+		// returns the index into the command table or -1 if name is neither a command nor an alias
+
+		template<std::size_t index_size> static constexpr int find(const std::array<entry_t, index_size> &index, std::string_view name)
+		{
+			const auto it = std::lower_bound(index.begin(), index.end(), name,
+					[](const entry_t &entry, std::string_view key) { return(entry.key < key); });
+
+			if((it == index.end()) || (it->key != name))
+				return(-1);
+
+			return(static_cast<int>(it->command_index));
+		}
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 
 enum cli_source_t
 {
@@ -16,12 +17,25 @@ enum cli_source_t
 struct command_response_t
 {
 	cli_source_t source;
+	unsigned int source_key;
 	unsigned int mtu;
 	std::string packet;
+	std::string oob;
+	std::string request_id;
+	unsigned int sequence;
+	int command_index;
+	std::int64_t time_received;
+	std::int64_t time_send_queued;
 
 	struct
 	{
 		unsigned int packetised:1;
+		unsigned int pooled:1;
+		unsigned int more:1;
+		unsigned int bulk:1;
+		unsigned int busy:1; // queued only to send a busy reply in order
+		unsigned int deferred:1; // counted once in the lane's deferred stats
+		unsigned int chunked:1; // client asked for a chunked reply instead of truncation
 	};
 
 	struct
@@ -37,6 +51,8 @@ struct command_response_t
 			unsigned int sin6_length;
 			char sin6_addr[32];
 		} address;
+		unsigned int connection; // TCP connection id, 0 for UDP
+		bool fragmented; // UDP request was received as fragments, reply likewise
 	} ip;
 
 	struct
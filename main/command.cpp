@@ -18,6 +18,7 @@
 #include "log.h"
 #include "command.h"
 #include "cli-command.h"
+#include "cli-parser.h"
 
 #include <map>
 #include <array>
@@ -25,8 +26,13 @@
 #include <chrono>
 #include <format>
 #include <thread>
+#include <bit>
 
 #include <esp_pthread.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+#include <sys/stat.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
@@ -50,12 +56,17 @@ void command_io_stats(cli_command_call_t *call);
 void command_io_write(cli_command_call_t *call);
 
 //FIXME
-int Command::cli_stats_commands_received = 0;
-int Command::cli_stats_commands_received_packet = 0;
-int Command::cli_stats_commands_received_raw = 0;
-int Command::cli_stats_replies_sent = 0;
-int Command::cli_stats_replies_sent_packet = 0;
-int Command::cli_stats_replies_sent_raw = 0;
+std::atomic<int> Command::cli_stats_commands_received = 0;
+std::atomic<int> Command::cli_stats_commands_received_packet = 0;
+std::atomic<int> Command::cli_stats_commands_received_raw = 0;
+std::atomic<int> Command::cli_stats_commands_received_batch = 0;
+std::atomic<int> Command::cli_stats_commands_received_binary = 0;
+std::atomic<int> Command::cli_stats_commands_received_request_id = 0;
+std::atomic<int> Command::cli_stats_replies_sent = 0;
+std::atomic<int> Command::cli_stats_replies_sent_packet = 0;
+std::atomic<int> Command::cli_stats_replies_sent_raw = 0;
+std::atomic<int> Command::cli_stats_replies_chunked = 0;
+std::atomic<int> Command::cli_stats_replies_truncated = 0;
 
 const std::map<cli_parameter_type_description_t, std::string> Command::parameter_type_to_string
 {
@@ -67,7 +78,15 @@ const std::map<cli_parameter_type_description_t, std::string> Command::parameter
 	{	cli_parameter_string_raw,	"raw string" },
 };
 
-const Command::cli_command_t Command::cli_commands[] =
+const std::map<Command::job_state_t, std::string> Command::job_state_to_string
+{
+	{	job_running,	"running" },
+	{	job_done,		"done" },
+	{	job_failed,		"failed" },
+	{	job_cancelled,	"cancelled" },
+};
+
+constexpr Command::cli_command_t Command::cli_commands[] =
 {
 	{ "alias", nullptr, "set alias", Command::alias,
 		{	2,
@@ -96,7 +115,13 @@ const Command::cli_command_t Command::cli_commands[] =
 		}
 	},
 
-	{ "command-info", "comi", "show info about command processing", Command::info, {}},
+	{ "command-info", "comi", "show info about command processing", Command::info,
+		{	1,
+			{
+				{ cli_parameter_string, 0, 0, 0, 0, "command to show latency histograms of", {}},
+			},
+		}
+	},
 	{ "config-dump", "cd", "dump all nvs keys", Command::config_dump, {}},
 
 	{ "config-erase", "ce", "erase a config entry", Command::config_erase,
@@ -176,6 +201,7 @@ const Command::cli_command_t Command::cli_commands[] =
 				{ cli_parameter_unsigned_int, 0, 1, 0, 0, "file length", {}},
 			},
 		},
+		{ .bulk = 1 },
 	},
 
 	{ "display-page-remove", "dpr", "remove page from display", Command::display_page_remove,
@@ -193,7 +219,8 @@ const Command::cli_command_t Command::cli_commands[] =
 				{ cli_parameter_unsigned_int, 0, 1, 0, 0, "offset", {}},
 				{ cli_parameter_string, 0, 1, 1, 1, "file", { .string = { 1, 64 }}},
 			}
-		}
+		},
+		{ .bulk = 1 },
 	},
 
 	{ "fs-checksum", nullptr, "checksum a file", Command::fs_checksum,
@@ -201,7 +228,8 @@ const Command::cli_command_t Command::cli_commands[] =
 			{
 				{ cli_parameter_string, 0, 1, 1, 1, "file", { .string = { 1, 64 }}},
 			}
-		}
+		},
+		{ .bulk = 1 },
 	},
 
 	{ "fs-erase", "rm", "erase file", Command::fs_erase,
@@ -217,7 +245,8 @@ const Command::cli_command_t Command::cli_commands[] =
 			{
 				{ cli_parameter_string, 0, 1, 0, 0, "partition name of fs to format", {}},
 			},
-		}
+		},
+		{ .serialise = 1 },
 	},
 
 	{ "fs-info", "fsi", "show info about the filesystems", Command::fs_info, {}},
@@ -256,7 +285,8 @@ const Command::cli_command_t Command::cli_commands[] =
 				{ cli_parameter_unsigned_int, 0, 1, 1, 1, "length", { .unsigned_int = { 0, 32768 }}},
 				{ cli_parameter_string, 0, 1, 1, 1, "file", { .string = { 1, 64 }}},
 			}
-		}
+		},
+		{ .bulk = 1 },
 	},
 
 	{ "help", "?", "this help", Command::command_help,
@@ -297,8 +327,8 @@ const Command::cli_command_t Command::cli_commands[] =
 		},
 	},
 
-	{ "info", (const char *)0, "show some generic information", Command::system_info, {}},
-	{ "info-board", "ib", "BSP info", Command::system_identify, {}},
+	{ "info", (const char *)0, "show some generic information", Command::system_info, {}, { .idempotent = 1 }},
+	{ "info-board", "ib", "BSP info", Command::system_identify, {}, { .idempotent = 1 }},
 	{ "info-partitions", "ip", "show information about partitions", Command::system_partitions,
 		{	1,
 			{
@@ -306,7 +336,7 @@ const Command::cli_command_t Command::cli_commands[] =
 			},
 		}
 	},
-	{ "info-memory", "im", "show information about memory", Command::system_memory, {}},
+	{ "info-memory", "im", "show information about memory", Command::system_memory, {}, { .idempotent = 1 }},
 	{ "io-dump", "iod", "dump everything known about found IOs", Command::io_dump, {}},
 
 	{ "io-read", "ior", "read from I/O pin", Command::io_read,
@@ -338,6 +368,32 @@ const Command::cli_command_t Command::cli_commands[] =
 		}
 	},
 
+	{ "job-cancel", "jc", "cancel a background job", Command::job_cancel,
+		{	1,
+			{
+				{ cli_parameter_unsigned_int, 0, 1, 0, 0, "job id", {}},
+			},
+		},
+	},
+
+	{ "job-info", "ji", "show background jobs", Command::job_info, {}},
+
+	{ "job-result", "jr", "fetch the result of a finished background job", Command::job_result,
+		{	1,
+			{
+				{ cli_parameter_unsigned_int, 0, 1, 0, 0, "job id", {}},
+			},
+		},
+	},
+
+	{ "job-start", "js", "run a command as background job", Command::job_start,
+		{	1,
+			{
+				{ cli_parameter_string_raw, 0, 1, 0, 0, "command", {}},
+			},
+		},
+	},
+
 	{ "ledpixel-info", "lpxi", "info about LEDpixels channels", Command::ledpixel_info, {}},
 	{ "ledpwm-info", "lpi", "info about LED PWM channels and timers", Command::ledpwm_info, {}},
 
@@ -369,18 +425,20 @@ const Command::cli_command_t Command::cli_commands[] =
 			{
 				{ cli_parameter_string, 0, 1, 1, 1, "checksum", { .string = { 64, 64 }}},
 			},
-		}
+		},
+		{ .serialise = 1 },
 	},
 
-	{ "ota-confirm", (const char*)0, "confirm ota image runs correctly", Command::ota_confirm, {}},
-	{ "ota-finish", (const char*)0, "finish ota session", Command::ota_finish, {}},
+	{ "ota-confirm", (const char*)0, "confirm ota image runs correctly", Command::ota_confirm, {}, { .serialise = 1 }},
+	{ "ota-finish", (const char*)0, "finish ota session", Command::ota_finish, {}, { .serialise = 1 }},
 
 	{ "ota-start", (const char*)0, "start ota session", Command::ota_start,
 		{	1,
 			{
 				{ cli_parameter_unsigned_int, 0, 1, 0, 0, "length", {}},
 			},
-		}
+		},
+		{ .serialise = 1 },
 	},
 
 	{ "ota-write", (const char*)0, "write one sector of ota data", Command::ota_write,
@@ -389,7 +447,8 @@ const Command::cli_command_t Command::cli_commands[] =
 				{ cli_parameter_unsigned_int, 0, 1, 0, 0, "length", {}},
 				{ cli_parameter_unsigned_int, 0, 1, 1, 1, "checksum flag", { .unsigned_int = { 0, 1 }}},
 			},
-		}
+		},
+		{ .serialise = 1, .bulk = 1 },
 	},
 
 	{ "pdm-info", "pin", "info about pdm channels", Command::pdm_info, {}},
@@ -429,7 +488,36 @@ const Command::cli_command_t Command::cli_commands[] =
 		},
 	},
 
-	{ "script-info", "sci", "info about running scripts", Command::script_info, {}},
+	{ "schedule-cron", "schc", "run a command at wall clock minutes/hours (*, N or */N)", Command::schedule_cron,
+		{	4,
+			{
+				{ cli_parameter_string, 0, 1, 1, 1, "job name", { .string = { 1, 16 }}},
+				{ cli_parameter_string, 0, 1, 0, 0, "minute", {}},
+				{ cli_parameter_string, 0, 1, 0, 0, "hour", {}},
+				{ cli_parameter_string_raw, 0, 1, 0, 0, "command", {}},
+			},
+		},
+	},
+
+	{ "schedule-every", "sche", "run a command every N milliseconds", Command::schedule_every,
+		{	3,
+			{
+				{ cli_parameter_string, 0, 1, 1, 1, "job name", { .string = { 1, 16 }}},
+				{ cli_parameter_unsigned_int, 0, 1, 1, 1, "interval (ms)", { .unsigned_int = { 10, 7 * 24 * 3600 * 1000 }}},
+				{ cli_parameter_string_raw, 0, 1, 0, 0, "command", {}},
+			},
+		},
+	},
+
+	{ "schedule-remove", "schr", "remove a scheduled job", Command::schedule_remove,
+		{	1,
+			{
+				{ cli_parameter_string, 0, 1, 0, 0, "job name", {}},
+			},
+		},
+	},
+
+	{ "script-info", "sci", "info about running scripts and scheduled jobs", Command::script_info, {}},
 
 	{ "script-stop", "scs", "info about running scripts", Command::script_stop,
 		{	1,
@@ -455,7 +543,7 @@ const Command::cli_command_t Command::cli_commands[] =
 		},
 	},
 
-	{ "sensor-json", "sj", "sensors values in json layout", Command::sensor_json, {}},
+	{ "sensor-json", "sj", "sensors values in json layout", Command::sensor_json, {}, { .idempotent = 1 }},
 	{ "sensor-stats", "ss", "sensors statistics", Command::sensor_stats, {}},
 
 	{ "tcp-info", "ti", "show information about tcp", Command::tcp_info, {}},
@@ -477,7 +565,7 @@ const Command::cli_command_t Command::cli_commands[] =
 		}
 	},
 
-	{ "wlan-info", "wi", "show information about wlan", Command::wlan_info, {}},
+	{ "wlan-info", "wi", "show information about wlan", Command::wlan_info, {}, { .idempotent = 1 }},
 
 	{ "write", "w", "write to output", Command::write,
 		{	1,
@@ -499,15 +587,53 @@ Command::Command(Config &config_in, Console &console_in, Ledpixel &ledpixel_in,
 		notify(notify_in), log(log_in), system(system_in), util(util_in), pdm(pdm_in), mcpwm(mcpwm_in),
 		fs(fs_in), bt(bt_in), wlan(wlan_in), udp(udp_in), tcp(tcp_in), i2c(i2c_in), sensors(sensors_in), display(display_in)
 {
+	int ix;
+
 	if(this->singleton)
 		throw(hard_exception("Command: already activated"));
 
-	if(!(receive_queue_handle = xQueueCreate(receive_queue_size, sizeof(command_response_t *))))
-		throw(hard_exception("Command: xQueueCreateStatic receive queue init failed"));
-
 	if(!(send_queue_handle = xQueueCreate(send_queue_size, sizeof(command_response_t *))))
 		throw(hard_exception("Command: xQueueCreateStatic send queue init failed"));
 
+	if(!(this->response_pool = static_cast<command_response_t *>(heap_caps_malloc(sizeof(command_response_t) * response_pool_size, MALLOC_CAP_SPIRAM))))
+		throw(hard_exception("Command: response pool allocation failed"));
+
+	for(ix = 0; ix < response_pool_size; ix++)
+	{
+		new(&this->response_pool[ix]) command_response_t;
+		this->response_pool[ix].pooled = 1;
+		this->response_pool_free[ix] = &this->response_pool[ix];
+	}
+
+	for(this->command_stats_size = 0; cli_commands[this->command_stats_size].name; this->command_stats_size++)
+		(void)0;
+
+	if(!(this->command_stats = static_cast<cli_command_stats_t *>(heap_caps_calloc(this->command_stats_size, sizeof(cli_command_stats_t), MALLOC_CAP_SPIRAM))))
+		throw(hard_exception("Command: command statistics allocation failed"));
+
+	this->response_pool_free_count = response_pool_size;
+	this->response_pool_stats_in_use_max = 0;
+	this->response_pool_stats_exhausted = 0;
+
+	this->script_cache_hits = 0;
+	this->script_cache_misses = 0;
+	this->schedule_task = nullptr;
+	this->schedule_scripts_run = 0;
+	this->schedule_scripts_dropped = 0;
+	this->aliases_active = false;
+	this->job_next_id = 1;
+	this->result_cache_ttl_ms = result_cache_ttl_default_ms;
+	this->result_cache_hits = 0;
+	this->result_cache_coalesced = 0;
+	this->result_cache_misses = 0;
+	this->receive_queue_sequence = 0;
+	this->receive_queue_bulk_active = 0;
+	this->receive_lane_stats = {};
+	this->receive_queue_busy_queued = 0;
+	this->receive_queue_busy_dropped = 0;
+
+	this->workers = 0;
+	this->chunked_replies = false;
 	this->running = false;
 	this->singleton = this;
 }
@@ -523,21 +649,63 @@ Command &Command::get()
 void Command::run()
 {
 	esp_pthread_cfg_t thread_config;
+	std::string thread_name;
+	int worker;
 
 	if(this->running)
 		throw(hard_exception("Command::run: already running"));
 
-	thread_config = esp_pthread_get_default_config();
-	thread_config.thread_name = "cmd recv";
-	thread_config.pin_to_core = 1;
-	thread_config.stack_size = 6 * 1024;
-	thread_config.prio = 1;
-	//thread_config.stack_alloc_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
-	esp_pthread_set_cfg(&thread_config);
+	this->alias_load();
+
+	try
+	{
+		this->workers = this->config.get_int("cmd.workers");
+	}
+	catch(const transient_exception &)
+	{
+		this->workers = workers_default;
+	}
+
+	if(this->workers < 1)
+		this->workers = 1;
+
+	if(this->workers > workers_max)
+		this->workers = workers_max;
+
+	try
+	{
+		this->chunked_replies = this->config.get_int("cmd.chunked") != 0;
+	}
+	catch(const transient_exception &)
+	{
+		this->chunked_replies = false;
+	}
+
+	try
+	{
+		this->result_cache_ttl_ms = this->config.get_int("cmd.cache_ttl");
+	}
+	catch(const transient_exception &)
+	{
+		this->result_cache_ttl_ms = result_cache_ttl_default_ms;
+	}
 
-	std::thread receive_thread([this]() { this->run_receive_queue(); });
+	for(worker = 0; worker < this->workers; worker++)
+	{
+		thread_name = std::format("cmd recv {:d}", worker);
+
+		thread_config = esp_pthread_get_default_config();
+		thread_config.thread_name = thread_name.c_str();
+		thread_config.pin_to_core = (worker + 1) % 2;
+		thread_config.stack_size = 6 * 1024;
+		thread_config.prio = 1;
+		//thread_config.stack_alloc_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+		esp_pthread_set_cfg(&thread_config);
 
-	receive_thread.detach();
+		std::thread receive_thread([this]() { this->run_receive_queue(); });
+
+		receive_thread.detach();
+	}
 
 	thread_config = esp_pthread_get_default_config();
 	thread_config.thread_name = "cmd send";
@@ -550,6 +718,30 @@ void Command::run()
 	std::thread send_thread([this]() { this->run_send_queue(); });
 
 	send_thread.detach();
+
+	thread_config = esp_pthread_get_default_config();
+	thread_config.thread_name = "cmd schedule";
+	thread_config.pin_to_core = 1;
+	thread_config.stack_size = 4 * 1024;
+	thread_config.prio = 2;
+	thread_config.stack_alloc_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+	esp_pthread_set_cfg(&thread_config);
+
+	std::thread schedule_thread([this]() { this->run_scheduler(); });
+
+	schedule_thread.detach();
+
+	thread_config = esp_pthread_get_default_config();
+	thread_config.thread_name = "cmd sched run";
+	thread_config.pin_to_core = 1;
+	thread_config.stack_size = 4 * 1024;
+	thread_config.prio = 1;
+	//thread_config.stack_alloc_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT; // NOTE: uses littlefs -> accesses flash, cannot have stack in SPI RAM
+	esp_pthread_set_cfg(&thread_config);
+
+	std::thread schedule_scripts_thread([this]() { this->run_schedule_scripts(); });
+
+	schedule_scripts_thread.detach();
 }
 
 void Command::help(std::string &out)
@@ -566,41 +758,50 @@ void Command::help(std::string &out)
 
 void Command::help(std::string &out, std::string_view filter)
 {
-	unsigned int command_index, parameter_index;
+	unsigned int parameter_index;
 	const cli_command_t *command;
 	const cli_parameter_description_t *parameter;
 	std::string delimiter[2];
 
-	for(command_index = 0; cli_commands[command_index].name; command_index++)
-	{
-		command = &cli_commands[command_index];
+	if(!(command = this->find_command(filter)))
+		return;
 
-		if((filter != command->name) && (!command->alias || (filter != command->alias)))
-			continue;
+	out += std::format("\n  {:<18s} {:<4s} {}", command->name, command->alias ? command->alias : "", command->help ? command->help : "");
 
-		out += std::format("\n  {:<18s} {:<4s} {}", command->name, command->alias ? command->alias : "", command->help ? command->help : "");
+	for(parameter_index = 0; parameter_index < command->parameters_description.count; parameter_index++)
+	{
+		parameter = &command->parameters_description.entries[parameter_index];
 
-		for(parameter_index = 0; parameter_index < command->parameters_description.count; parameter_index++)
+		if(parameter->value_required)
 		{
-			parameter = &command->parameters_description.entries[parameter_index];
-
-			if(parameter->value_required)
-			{
-				delimiter[0] = "[";
-				delimiter[1] = "]";
-			}
-			else
-			{
-				delimiter[0] = "(";
-				delimiter[1] = ")";
-			}
-
-			out += std::format(" {}{} {}{}", delimiter[0], this->parameter_type_to_string.at(parameter->type),
-					parameter->description ? parameter->description : "", delimiter[1]);
+			delimiter[0] = "[";
+			delimiter[1] = "]";
+		}
+		else
+		{
+			delimiter[0] = "(";
+			delimiter[1] = ")";
 		}
+
+		out += std::format(" {}{} {}{}", delimiter[0], this->parameter_type_to_string.at(parameter->type),
+				parameter->description ? parameter->description : "", delimiter[1]);
 	}
 }
 
+const Command::cli_command_t *Command::find_command(std::string_view name)
+{
+	static constexpr unsigned int index_size = CommandIndex::size(cli_commands);
+	static constexpr std::array<CommandIndex::entry_t, index_size> index = CommandIndex::build<index_size>(cli_commands);
+	int command_index;
+
+	static_assert(CommandIndex::unique(index), "Command::cli_commands: duplicate command name or alias");
+
+	if((command_index = CommandIndex::find(index, name)) < 0)
+		return(nullptr);
+
+	return(&cli_commands[command_index]);
+}
+
 std::string Command::make_exception_text(std::string_view fn, std::string_view message1, std::string_view message2)
 {
 	return(std::format("{}: {}{}", fn, message1, message2));
@@ -935,6 +1136,8 @@ void Command::fs_format(cli_command_call_t *call)
 		return;
 	}
 
+	instance.script_cache_evict(call->parameters[0].str);
+
 	call->result = std::format("format {} OK", call->parameters[0].str);
 }
 
@@ -971,6 +1174,8 @@ void Command::fs_write(cli_command_call_t *call)
 		return;
 	}
 
+	instance.script_cache_evict(call->parameters[2].str);
+
 	call->result = std::format("OK file length: {:d}", length);
 }
 
@@ -988,6 +1193,8 @@ void Command::fs_erase(cli_command_call_t *call)
 		return;
 	}
 
+	instance.script_cache_evict(call->parameters[0].str);
+
 	call->result = "OK file erased";
 }
 
@@ -1005,6 +1212,9 @@ void Command::fs_rename(cli_command_call_t *call)
 		return;
 	}
 
+	instance.script_cache_evict(call->parameters[0].str);
+	instance.script_cache_evict(call->parameters[1].str);
+
 	call->result = "OK file renamed";
 }
 
@@ -1022,6 +1232,8 @@ void Command::fs_truncate(cli_command_call_t *call)
 		return;
 	}
 
+	instance.script_cache_evict(call->parameters[0].str);
+
 	call->result = "OK truncated";
 }
 
@@ -1032,12 +1244,11 @@ void Command::fs_checksum(cli_command_call_t *call)
 
 	try
 	{
-		checksum = instance.fs.checksum(call->parameters[0].str);
+		checksum = instance.fs.checksum(call->parameters[0].str, call->progress);
 	}
 	catch(const transient_exception &e)
 	{
-		call->result = std::format("fs-checksum: {}", e.what());
-		return;
+		throw(transient_exception(std::format("fs-checksum: {}", e.what())));
 	}
 
 	call->result = std::format("OK checksum: {}", checksum);
@@ -1112,16 +1323,212 @@ void Command::write(cli_command_call_t *call)
 		call->result = call->parameters[0].str;
 }
 
+void Command::latency_record(latency_stats_t &stats, std::int64_t usec_in)
+{
+	unsigned int usec, bucket;
+
+	usec = usec_in < 0 ? 0 : static_cast<unsigned int>(std::min(usec_in, static_cast<std::int64_t>(~0U)));
+
+	if((stats.count == 0) || (usec < stats.min))
+		stats.min = usec;
+
+	if(usec > stats.max)
+		stats.max = usec;
+
+	stats.count++;
+	stats.total += usec;
+
+	bucket = std::min(static_cast<unsigned int>(std::bit_width(usec)), static_cast<unsigned int>(latency_buckets - 1));
+	stats.histogram[bucket]++;
+}
+
+// Histogram bucket n holds values of n significant bits, i.e. from 2^(n-1) up to 2^n - 1 microseconds,
+// so a percentile is reported as the upper bound of the bucket it falls in.
+
+unsigned int Command::latency_percentile(const latency_stats_t &stats, unsigned int percentile)
+{
+	unsigned int bucket, threshold, cumulative;
+
+	if(stats.count == 0)
+		return(0);
+
+	threshold = ((stats.count * percentile) + 99) / 100;
+
+	for(bucket = 0, cumulative = 0; bucket < latency_buckets; bucket++)
+		if((cumulative += stats.histogram[bucket]) >= threshold)
+			break;
+
+	if(bucket >= (latency_buckets - 1))
+		return(stats.max);
+
+	return(std::min((1U << bucket) - 1, stats.max));
+}
+
+void Command::latency_format(std::string &out, std::string_view name, const latency_stats_t &stats, bool histogram)
+{
+	unsigned int bucket;
+
+	out += std::format("\n    {:<8s} min: {:d}, avg: {:d}, max: {:d}, p99: {:d} us", name,
+			stats.min, stats.count ? static_cast<unsigned int>(stats.total / stats.count) : 0, stats.max, latency_percentile(stats, 99));
+
+	if(!histogram)
+		return;
+
+	for(bucket = 0; bucket < latency_buckets; bucket++)
+		if(stats.histogram[bucket])
+			out += std::format("\n      < {:>9d} us: {:d}", 1U << bucket, stats.histogram[bucket]);
+}
+
+void Command::command_stats_record(int command_index, latency_stats_t cli_command_stats_t::*which, std::int64_t usec)
+{
+	if((command_index < 0) || (static_cast<unsigned int>(command_index) >= this->command_stats_size))
+		return;
+
+	std::scoped_lock<std::mutex> lock(this->command_stats_mutex);
+
+	latency_record(this->command_stats[command_index].*which, usec);
+}
+
+// A failed command counts as an error and, if it got as far as running, its execute time is recorded as well,
+// so commands that fail slowly show up in the latency statistics too.
+
+void Command::command_stats_failed(int command_index, std::int64_t time_execute)
+{
+	if((command_index < 0) || (static_cast<unsigned int>(command_index) >= this->command_stats_size))
+		return;
+
+	std::scoped_lock<std::mutex> lock(this->command_stats_mutex);
+
+	this->command_stats[command_index].errors++;
+
+	if(time_execute > 0)
+		latency_record(this->command_stats[command_index].execute, esp_timer_get_time() - time_execute);
+}
+
 void Command::info(cli_command_call_t *call)
 {
+	auto& instance = Command::get();
+	cli_command_stats_t stats;
+	const cli_command_t *cli_command;
+	unsigned int command_index;
+	unsigned int result_cache_entries, result_cache_hits, result_cache_coalesced, result_cache_misses;
+	int result_cache_ttl_ms;
+	std::array<receive_lane_stats_t, receive_lane_size> lane_stats;
+	std::array<unsigned int, receive_lane_size> lane_queued;
+	std::map<unsigned int, busy_source_t> busy_sources;
+	unsigned int bulk_active, busy_queued, busy_dropped;
+	unsigned int pool_free, pool_in_use_max, pool_exhausted;
+
+	if(call->parameter_count > 0)
+	{
+		if(!(cli_command = instance.find_command(call->parameters[0].str)))
+			throw(transient_exception(std::format("command-info: unknown command \"{}\"", call->parameters[0].str)));
+
+		command_index = cli_command - cli_commands;
+
+		instance.command_stats_mutex.lock();
+		stats = instance.command_stats[command_index];
+		instance.command_stats_mutex.unlock();
+
+		call->result = std::format("command {} (binary index {:d}): calls: {:d}, errors: {:d}", cli_command->name, command_index, stats.calls, stats.errors);
+		instance.latency_format(call->result, "queue", stats.queue, true);
+		instance.latency_format(call->result, "execute", stats.execute, true);
+		instance.latency_format(call->result, "send", stats.send, true);
+
+		return;
+	}
+
 	call->result = "commands received:";
-	call->result += std::format("\n- total: {:d}", cli_stats_commands_received);
-	call->result += std::format("\n- packetised: {:d}", cli_stats_commands_received_packet);
-	call->result += std::format("\n- raw: {:d}", cli_stats_commands_received_raw);
+	call->result += std::format("\n- total: {:d}", cli_stats_commands_received.load());
+	call->result += std::format("\n- packetised: {:d}", cli_stats_commands_received_packet.load());
+	call->result += std::format("\n- raw: {:d}", cli_stats_commands_received_raw.load());
+	call->result += std::format("\n- batch: {:d}", cli_stats_commands_received_batch.load());
+	call->result += std::format("\n- binary: {:d}", cli_stats_commands_received_binary.load());
+	call->result += std::format("\n- with request id: {:d}", cli_stats_commands_received_request_id.load());
 	call->result += "\nreplies sent:";
-	call->result += std::format("\n- total: {:d}", cli_stats_replies_sent);
-	call->result += std::format("\n- packetised: {:d}", cli_stats_replies_sent_packet);
-	call->result += std::format("\n- raw: {:d}", cli_stats_replies_sent_raw);
+	call->result += std::format("\n- total: {:d}", cli_stats_replies_sent.load());
+	call->result += std::format("\n- packetised: {:d}", cli_stats_replies_sent_packet.load());
+	call->result += std::format("\n- raw: {:d}", cli_stats_replies_sent_raw.load());
+	call->result += std::format("\n- chunked: {:d}", cli_stats_replies_chunked.load());
+	call->result += std::format("\n- truncated: {:d}", cli_stats_replies_truncated.load());
+	call->result += std::format("\nchunked replies on packet transports: {}", instance.util.yesno(instance.chunked_replies));
+	call->result += std::format("\nworkers: {:d}", instance.workers);
+
+	// every set of statistics is copied under its own lock and formatted afterwards, so no lock is held
+	// while formatting and none of them is taken while holding another one
+
+	call->result += "\nper command statistics:";
+
+	for(command_index = 0; command_index < instance.command_stats_size; command_index++)
+	{
+		instance.command_stats_mutex.lock();
+		stats = instance.command_stats[command_index];
+		instance.command_stats_mutex.unlock();
+
+		if(stats.calls == 0)
+			continue;
+
+		call->result += std::format("\n  {}: calls: {:d}, errors: {:d}", cli_commands[command_index].name, stats.calls, stats.errors);
+		instance.latency_format(call->result, "queue", stats.queue, false);
+		instance.latency_format(call->result, "execute", stats.execute, false);
+		instance.latency_format(call->result, "send", stats.send, false);
+	}
+
+	instance.result_cache_mutex.lock();
+	result_cache_entries = instance.result_cache.size();
+	result_cache_ttl_ms = instance.result_cache_ttl_ms;
+	result_cache_hits = instance.result_cache_hits;
+	result_cache_coalesced = instance.result_cache_coalesced;
+	result_cache_misses = instance.result_cache_misses;
+	instance.result_cache_mutex.unlock();
+
+	call->result += "\nresult cache:";
+	call->result += std::format("\n- entries: {:d}/{:d}, ttl: {:d} ms", result_cache_entries, result_cache_size, result_cache_ttl_ms);
+	call->result += std::format("\n- hits: {:d}, coalesced: {:d}, misses: {:d}", result_cache_hits, result_cache_coalesced, result_cache_misses);
+
+	instance.receive_queue_mutex.lock();
+
+	for(unsigned int lane = 0; lane < receive_lane_size; lane++)
+		lane_queued[lane] = instance.receive_queue[lane].size();
+
+	lane_stats = instance.receive_lane_stats;
+	busy_sources = instance.receive_queue_busy;
+	bulk_active = instance.receive_queue_bulk_active;
+	busy_queued = instance.receive_queue_busy_queued;
+	busy_dropped = instance.receive_queue_busy_dropped;
+
+	instance.receive_queue_mutex.unlock();
+
+	for(unsigned int lane = 0; lane < receive_lane_size; lane++)
+	{
+		call->result += std::format("\n{} lane:", (lane == receive_lane_bulk) ? "bulk" : "interactive");
+		call->result += std::format("\n- queued: {:d}, max: {:d}", lane_queued[lane], lane_stats[lane].queued_max);
+		call->result += std::format("\n- dispatched: {:d}", lane_stats[lane].dispatched);
+		call->result += std::format("\n- deferred for other lane: {:d}", lane_stats[lane].deferred);
+		call->result += std::format("\n- waits for room: {:d}", lane_stats[lane].push_waits);
+	}
+
+	call->result += std::format("\n- bulk requests running: {:d}", bulk_active);
+	call->result += "\nbusy replies:";
+
+	for(const auto &[key, busy] : busy_sources)
+		call->result += std::format("\n- {} client {:08x}: {:d} replies, {:d} dropped, last {:d} s ago", source_name(busy.source), key,
+				busy.replies, busy.dropped, (esp_timer_get_time() - busy.time_last) / 1000000);
+
+	call->result += std::format("\n- queued behind earlier replies: {:d}", busy_queued);
+	call->result += std::format("\n- dropped: {:d}", busy_dropped);
+
+	instance.response_pool_mutex.lock();
+	pool_free = instance.response_pool_free_count;
+	pool_in_use_max = instance.response_pool_stats_in_use_max;
+	pool_exhausted = instance.response_pool_stats_exhausted;
+	instance.response_pool_mutex.unlock();
+
+	call->result += "\nresponse pool:";
+	call->result += std::format("\n- size: {:d}", response_pool_size);
+	call->result += std::format("\n- in use: {:d}", response_pool_size - pool_free);
+	call->result += std::format("\n- max in use: {:d}", pool_in_use_max);
+	call->result += std::format("\n- exhausted: {:d}", pool_exhausted);
 }
 
 void Command::bluetooth_info(cli_command_call_t *call)
@@ -1348,7 +1755,11 @@ void Command::alias(cli_command_call_t *call)
 
 void Command::alias_command(cli_command_call_t *call)
 {
-	string_string_map::const_iterator it;
+	std::scoped_lock<std::mutex> lock(this->aliases_mutex);
+	string_string_map new_aliases;
+	alias_index_t new_aliases_resolved;
+
+	new_aliases = this->aliases;
 
 	switch(call->parameter_count)
 	{
@@ -1359,16 +1770,13 @@ void Command::alias_command(cli_command_call_t *call)
 
 		case(1):
 		{
-			if((it = aliases.find(call->parameters[0].str)) != aliases.end())
-				aliases.erase(it);
-
+			new_aliases.erase(call->parameters[0].str);
 			break;
 		}
 
 		case(2):
 		{
-			aliases.insert_or_assign(call->parameters[0].str, call->parameters[1].str);
-			break;
+			new_aliases.insert_or_assign(call->parameters[0].str, call->parameters[1].str);
 			break;
 		}
 
@@ -1379,40 +1787,164 @@ void Command::alias_command(cli_command_call_t *call)
 		}
 	}
 
+	// store first, so a definition that can't be saved doesn't take effect either
+
+	if(call->parameter_count > 0)
+	{
+		this->alias_resolve(new_aliases, new_aliases_resolved);
+		this->alias_save(new_aliases);
+
+		this->aliases.swap(new_aliases);
+		this->aliases_resolved.swap(new_aliases_resolved);
+		this->aliases_active = !this->aliases.empty();
+	}
+
 	call->result = "ALIASES";
 
-	for(const auto &ref : aliases)
-		call->result += std::format("\n  {}: {}", ref.first, ref.second);
+	for(const auto &ref : this->aliases)
+		call->result += std::format("\n  {}: {} -> {}", ref.first, ref.second, this->aliases_resolved.at(ref.first));
 }
 
-void Command::wlan_client_config(cli_command_call_t *call)
+// Aliases are resolved completely when they're defined, so an alias that expands to another alias
+// costs nothing extra at expansion time. Like in a shell, expansion stops at a name that has already
+// been expanded on the way, so an alias can refer to the command it hides ("alias ls ls /littlefs").
+// Definitions that nest too deep are rejected.
+
+void Command::alias_resolve(const string_string_map &definitions, alias_index_t &resolved)
 {
-	auto& instance = Command::get();
+	std::string text, head;
+	std::string::size_type delimiter;
+	string_string_map::const_iterator it;
+	std::set<std::string> visited;
+	unsigned int depth;
 
-	std::string ssid;
-	std::string passwd;
+	resolved.clear();
 
-	if(call->parameter_count == 1)
-		throw(hard_exception("wlan_client_config: need to set both ssid and passwd"));
+	for(const auto &definition : definitions)
+	{
+		text = definition.second;
+		visited.clear();
+		visited.insert(definition.first);
 
-	if(call->parameter_count > 2)
-		throw(hard_exception("wlan_client_config: invalid arguments"));
+		for(depth = 0;; depth++)
+		{
+			delimiter = text.find_first_of(" \t");
+			head = text.substr(0, delimiter);
 
-	if(call->parameter_count == 2)
-		instance.wlan.set(call->parameters[0].str, call->parameters[1].str);
+			if(visited.contains(head) || ((it = definitions.find(head)) == definitions.end()))
+				break;
 
-	instance.wlan.get(ssid, passwd);
+			if(depth >= alias_depth_max)
+				throw(transient_exception(std::format("alias: {} nests more than {:d} levels", definition.first, alias_depth_max)));
 
-	call->result = std::format("wlan client, ssid: {}, password: {}", ssid, passwd);
+			visited.insert(head);
+			text = it->second + ((delimiter == std::string::npos) ? "" : text.substr(delimiter));
+		}
+
+		resolved[definition.first] = text;
+	}
 }
 
-void Command::wlan_ipv6_static(cli_command_call_t *call)
+// All aliases are stored in one config entry, one "name substitution" per line, as alias names can be longer than NVS keys.
+
+void Command::alias_load()
 {
-	auto& instance = Command::get();
-	std::string address;
+	std::string stored, line;
+	std::string::size_type start, end, delimiter;
+	string_string_map definitions;
+	alias_index_t resolved;
 
-	if(call->parameter_count == 1)
-		instance.wlan.set_ipv6_static(call->parameters[0].str);
+	try
+	{
+		stored = this->config.get_string("cmd.aliases");
+	}
+	catch(const transient_exception &)
+	{
+		return;
+	}
+
+	for(start = 0; start < stored.length(); start = end + 1)
+	{
+		if((end = stored.find('\n', start)) == std::string::npos)
+			end = stored.length();
+
+		line = stored.substr(start, end - start);
+
+		if((delimiter = line.find(' ')) != std::string::npos)
+			definitions[line.substr(0, delimiter)] = line.substr(delimiter + 1);
+	}
+
+	try
+	{
+		this->alias_resolve(definitions, resolved);
+	}
+	catch(const transient_exception &e)
+	{
+		this->log << std::format("command: stored aliases ignored: {}", e.what());
+		return;
+	}
+
+	std::scoped_lock<std::mutex> lock(this->aliases_mutex);
+
+	this->aliases.swap(definitions);
+	this->aliases_resolved.swap(resolved);
+	this->aliases_active = !this->aliases.empty();
+}
+
+void Command::alias_save(const string_string_map &definitions)
+{
+	std::string stored;
+
+	if(definitions.empty())
+	{
+		try
+		{
+			this->config.erase("cmd.aliases");
+		}
+		catch(const transient_exception &)
+		{
+		}
+
+		return;
+	}
+
+	for(const auto &definition : definitions)
+		stored += std::format("{}{} {}", stored.empty() ? "" : "\n", definition.first, definition.second);
+
+	if(stored.length() > alias_config_size_max)
+		throw(transient_exception(std::format("alias: aliases take {:d} bytes, more than can be stored ({:d}), not saved", stored.length(), alias_config_size_max)));
+
+	this->config.set_string("cmd.aliases", stored);
+}
+
+void Command::wlan_client_config(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+
+	std::string ssid;
+	std::string passwd;
+
+	if(call->parameter_count == 1)
+		throw(hard_exception("wlan_client_config: need to set both ssid and passwd"));
+
+	if(call->parameter_count > 2)
+		throw(hard_exception("wlan_client_config: invalid arguments"));
+
+	if(call->parameter_count == 2)
+		instance.wlan.set(call->parameters[0].str, call->parameters[1].str);
+
+	instance.wlan.get(ssid, passwd);
+
+	call->result = std::format("wlan client, ssid: {}, password: {}", ssid, passwd);
+}
+
+void Command::wlan_ipv6_static(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+	std::string address;
+
+	if(call->parameter_count == 1)
+		instance.wlan.set_ipv6_static(call->parameters[0].str);
 
 	instance.wlan.get_ipv6_static(address);
 
@@ -1495,32 +2027,37 @@ void Command::cat(cli_command_call_t *call)
 		call->result += "\n(...)";
 }
 
+Command::script_state_t *Command::script_state_new(const std::string &script, std::shared_ptr<const script_program_t> program)
+{
+	script_state_t *state = new script_state_t();
+
+	state->repeat.active = false;
+	state->repeat.target = 0;
+	state->repeat.current = 0;
+	state->script = script;
+	state->program = program;
+	state->line = 0;
+
+	return(state);
+}
+
 void Command::command_run(cli_command_call_t *call)
 {
 	auto& instance = Command::get();
 	unsigned int ix;
 	esp_err_t rv;
 	esp_pthread_cfg_t thread_config = esp_pthread_get_default_config();
-	auto *thread_state = new script_state_t();
+	std::shared_ptr<const script_program_t> program;
+	script_state_t *thread_state;
+
+	if(!(program = instance.script_load(call->parameters[0].str)))
+		throw(transient_exception(std::format("run script: script {} not found", call->parameters[0].str)));
 
-	thread_state->repeat.active = false;
-	thread_state->repeat.target = 0;
-	thread_state->repeat.current = 0;
-	thread_state->script = call->parameters[0].str;
+	thread_state = script_state_new(call->parameters[0].str, program);
 
 	for(ix = 1; ix < call->parameter_count; ix++)
 		thread_state->parameter.push_back(call->parameters[ix].str);
 
-	thread_state->file.open(std::format("/ramdisk/{}", thread_state->script));
-
-	if(thread_state->file.fail())
-	{
-		thread_state->file.open(std::format("/littlefs/{}", thread_state->script));
-
-		if(thread_state->file.fail())
-			throw(transient_exception(std::format("run script: script {} not found", thread_state->script)));
-	}
-
 	thread_config.thread_name = call->parameters[0].str.c_str();
 	thread_config.pin_to_core = 1;
 	thread_config.stack_size = 4 * 1024;
@@ -1544,419 +2081,1502 @@ void Command::script_info(cli_command_call_t *call)
 	call->result = "SCRIPT THREADS:";
 
 	for(auto const &script : instance.script_thread_map)
-		call->result += std::format("\n{:2d}: {}, stop sent: {}, stopping: {}", script.first, script.second.command_line,
+		call->result += std::format("\n{:2d}: {}, stop sent: {}, stopping: {}, window: {:d}", script.first, script.second.command_line,
 				instance.util.yesno(script.second.stop),
-				instance.util.yesno(script.second.stopping));
+				instance.util.yesno(script.second.stopping),
+				script.second.window);
 
 	instance.script_thread_mutex.unlock();
-}
 
-void Command::script_stop(cli_command_call_t *call)
-{
-	auto& instance = Command::get();
-	int filter;
+	instance.script_cache_mutex.lock();
 
-	if(call->parameter_count == 0)
-		filter = -1;
-	else
-		filter = call->parameters[0].unsigned_int;
+	call->result += std::format("\nSCRIPT CACHE: entries: {:d}/{:d}, hits: {:d}, misses: {:d}",
+			instance.script_cache.size(), script_cache_size, instance.script_cache_hits, instance.script_cache_misses);
 
-	call->result += "Stopping script threads:";
+	for(auto const &entry : instance.script_cache)
+		call->result += std::format("\n  {}: {:d} lines, {:d} bytes", entry.first, entry.second->lines.size(), static_cast<unsigned int>(entry.second->size));
 
-	instance.script_thread_mutex.lock();
+	instance.script_cache_mutex.unlock();
 
-	for(auto &script : instance.script_thread_map)
+	instance.schedule_mutex.lock();
+
+	call->result += std::format("\nSCHEDULED JOBS: {:d}/{:d}, scripts run: {:d}, queued: {:d}, dropped: {:d}",
+			instance.schedule_jobs.size(), schedule_jobs_max,
+			instance.schedule_scripts_run, instance.schedule_scripts.size(), instance.schedule_scripts_dropped);
+
+	for(auto const &entry : instance.schedule_jobs)
 	{
-		if((script.first == filter) || (filter < 0))
-		{
-			script.second.stop = true;
-			call->result += std::format("\nscript \"{}\" [{:d}] closing down", script.second.command_line, script.first);
-		}
+		const schedule_job_t &job = entry.second;
+
+		if(job.interval_ms)
+			call->result += std::format("\n  {}: every {:d} ms", entry.first, job.interval_ms);
+		else
+			call->result += std::format("\n  {}: at minute {} hour {}{}", entry.first,
+					schedule_cron_string(job.minute), schedule_cron_string(job.hour), job.armed ? "" : " (waiting for clock)");
+
+		call->result += std::format(": \"{}\", fired: {:d}, missed: {:d}", job.command, job.fired, job.missed);
+		instance.latency_format(call->result, "late", job.lateness, false);
 	}
 
-	instance.script_thread_mutex.unlock();
+	instance.schedule_mutex.unlock();
 }
 
-void Command::i2c_speed(cli_command_call_t *call)
+// Background jobs run a command in a thread of their own, the caller gets a job id immediately and can
+// poll the job's progress, cancel it or fetch its result later. Commands that take long report
+// their progress through call->progress, which is also where cancellation takes effect.
+// Finished jobs are kept until their result is fetched, or until room is needed for a new job.
+
+void Command::job_start(cli_command_call_t *call)
 {
 	auto& instance = Command::get();
-	int module;
-	int speed;
+	esp_pthread_cfg_t thread_config = esp_pthread_get_default_config();
+	std::string command_line, command;
+	std::map<unsigned int, job_t>::iterator it;
+	unsigned int id, running;
+	esp_err_t rv;
+	job_t job;
 
-	module = call->parameters[0].unsigned_int;
+	command_line = call->parameters[0].str;
+	instance.alias_expand(command_line);
+	CliParser::command(command_line, command);
 
-	if(call->parameter_count > 1)
-		instance.i2c.speed(module, call->parameters[1].unsigned_int);
+	if(!instance.find_command(command))
+		throw(transient_exception(std::format("job-start: unknown command \"{}\"", command)));
 
-	speed = instance.i2c.speed(module);
+	std::unique_lock<std::mutex> lock(instance.jobs_mutex);
 
-	call->result = std::format("i2c speed of module {:d} is {:d} kHz", module, speed);
-}
+	running = std::count_if(instance.jobs.begin(), instance.jobs.end(), [](const auto &entry) { return(entry.second.state == job_running); });
 
-void Command::i2c_probe(cli_command_call_t *call)
-{
-	auto& instance = Command::get();
+	if(running >= jobs_running_max)
+		throw(transient_exception(std::format("job-start: too many jobs running ({:d})", running)));
 
-	call->result = std::format("probe {:d}/{:d}/{:#04x}: {}",
-			call->parameters[0].unsigned_int,
-			call->parameters[1].unsigned_int,
-			call->parameters[2].unsigned_int,
-			instance.i2c.probe(call->parameters[0].unsigned_int, call->parameters[1].unsigned_int, call->parameters[2].unsigned_int) ? "ok" : "not found");
-}
+	if(instance.jobs.size() >= jobs_max)
+	{
+		for(it = instance.jobs.begin(); it != instance.jobs.end(); it++)
+			if(it->second.state != job_running)
+				break;
 
-void Command::i2c_info(cli_command_call_t *call)
-{
-	auto& instance = Command::get();
+		if(it == instance.jobs.end())
+			throw(transient_exception("job-start: no room for new job"));
 
-	call->result = "I2C INFO";
-	instance.i2c.info(call->result);
-}
+		instance.jobs.erase(it);
+	}
 
-void Command::sensor_dump(cli_command_call_t *call)
-{
-	auto& instance = Command::get();
+	id = instance.job_next_id++;
 
-	call->result = "SENSORS DUMP\n";
+	job.command_line = call->parameters[0].str;
+	job.state = job_running;
+	job.cancel = false;
+	job.progress = 0;
+	job.time_start = esp_timer_get_time();
+	job.time_finish = 0;
 
-	if(call->parameter_count == 0)
-		call->result += instance.sensors.dump();
-	else
-		call->result += instance.sensors.dump(call->parameters[0].unsigned_int);
-}
+	instance.jobs[id] = job;
 
-void Command::sensor_info(cli_command_call_t *call)
-{
-	auto& instance = Command::get();
+	lock.unlock();
 
-	if(call->parameter_count == 0)
-		call->result += instance.sensors.info();
-	else
-		call->result += instance.sensors.info(call->parameters[0].unsigned_int);
-}
+	thread_config.thread_name = "cmd job";
+	thread_config.pin_to_core = 1;
+	thread_config.stack_size = 6 * 1024;
+	thread_config.prio = 1;
+	//thread_config.stack_alloc_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT; // NOTE: uses littlefs and flash, cannot have stack in SPI RAM
 
-void Command::sensor_json(cli_command_call_t *call)
-{
-	auto& instance = Command::get();
+	if((rv = esp_pthread_set_cfg(&thread_config)) != ESP_OK)
+	{
+		instance.jobs_mutex.lock();
+		instance.jobs.erase(id);
+		instance.jobs_mutex.unlock();
 
-	call->result += instance.sensors.json();
-}
+		throw(hard_exception(instance.log.esp_string_error(rv, "Command::job_start: esp_pthread_set_cfg")));
+	}
 
-void Command::sensor_stats(cli_command_call_t *call)
-{
-	auto& instance = Command::get();
+	std::thread job_thread([id]() { Command::singleton->job_runner(id); });
 
-	call->result = "SENSORS STATS\n";
-	call->result += instance.sensors.stats();
+	job_thread.detach();
+
+	call->result = std::format("job {:d} started: {}", id, call->parameters[0].str);
 }
 
-command_response_t *Command::receive_queue_pop()
+void Command::job_runner(unsigned int id)
 {
-	command_response_t *command_response = nullptr;
+	command_response_t command_response;
+	cli_command_call_t call;
+	std::string command_line;
+	bool failed, cancelled;
 
-	if(!this->receive_queue_handle)
-		throw(hard_exception("Command::receive_queue_pop: queue inactive"));
+	this->jobs_mutex.lock();
+	command_line = this->jobs.at(id).command_line;
+	this->jobs_mutex.unlock();
 
-	xQueueReceive(this->receive_queue_handle, &command_response, portMAX_DELAY);
+	command_response.source = cli_source_none;
+	command_response.source_key = 0;
+	command_response.mtu = job_mtu;
+	command_response.time_received = esp_timer_get_time();
 
-	this->cli_stats_commands_received++;
+	cancelled = false;
 
-	return(command_response);
-}
+	call.progress = [this, id, &cancelled](unsigned int percent)
+	{
+		std::scoped_lock<std::mutex> lock(this->jobs_mutex);
+		job_t &job = this->jobs.at(id);
 
-void Command::send_queue_push(command_response_t *command_response)
-{
-	if(!this->send_queue_handle)
-		throw(hard_exception("Command::send_queue_push: queue inactive"));
+		job.progress = percent;
 
-	if(!command_response)
-		throw(hard_exception("Command::send_queue_push: invalid argument"));
+		if(job.cancel)
+		{
+			cancelled = true;
+			throw(transient_exception("job cancelled"));
+		}
+	};
 
-	xQueueSendToBack(this->send_queue_handle, &command_response, portMAX_DELAY);
+	this->execute(&command_response, command_line, call, &failed);
 
-	if(command_response->packetised)
-		this->cli_stats_replies_sent_packet++;
+	std::scoped_lock<std::mutex> lock(this->jobs_mutex);
+	job_t &job = this->jobs.at(id);
+
+	// a command fails by throwing, a cancelled one because its progress callback threw,
+	// progress is left where the command got to
+
+	if(failed)
+		job.state = cancelled ? job_cancelled : job_failed;
 	else
-		this->cli_stats_replies_sent_raw++;
+	{
+		job.state = job_done;
+		job.progress = 100;
+	}
 
-	this->cli_stats_replies_sent++;
+	job.time_finish = esp_timer_get_time();
+	job.result.swap(call.result);
+	job.result_oob.swap(call.result_oob);
 }
 
-command_response_t *Command::send_queue_pop()
+void Command::job_info(cli_command_call_t *call)
 {
-	command_response_t *command_response = nullptr;
+	auto& instance = Command::get();
+	std::scoped_lock<std::mutex> lock(instance.jobs_mutex);
+	std::int64_t elapsed;
 
-	xQueueReceive(send_queue_handle, &command_response, portMAX_DELAY);
+	call->result = std::format("JOBS: {:d}/{:d}", instance.jobs.size(), jobs_max);
 
-	return(command_response);
+	for(const auto &entry : instance.jobs)
+	{
+		const job_t &job = entry.second;
+
+		elapsed = ((job.state == job_running) ? esp_timer_get_time() : job.time_finish) - job.time_start;
+
+		call->result += std::format("\n{:3d}: {}, {}, {:d}%, {:d} ms{}", entry.first, job.command_line,
+				job_state_to_string.at(job.state), job.progress, elapsed / 1000,
+				(job.cancel && (job.state == job_running)) ? ", cancel requested" : "");
+	}
 }
 
-void Command::run_receive_queue()
+void Command::job_result(cli_command_call_t *call)
 {
-	command_response_t					*command_response;
-	std::string							data;
-	std::string::const_iterator			data_iterator;
-	std::string							oob_data;
-	std::string							command;
-	unsigned int						count, current, ix;
-	const cli_command_t					*cli_command;
-	cli_parameter_t						*parameter;
-	const cli_parameter_description_t	*parameter_description;
-	cli_command_call_t					call;
+	auto& instance = Command::get();
+	std::scoped_lock<std::mutex> lock(instance.jobs_mutex);
+	std::map<unsigned int, job_t>::iterator it;
 
-	try
+	if((it = instance.jobs.find(call->parameters[0].unsigned_int)) == instance.jobs.end())
+		throw(transient_exception(std::format("job-result: job {:d} not found", call->parameters[0].unsigned_int)));
+
+	if(it->second.state == job_running)
 	{
-		for(;;)
-		{
-			command_response = receive_queue_pop();
-			Packet::decapsulate(command_response->packetised, command_response->packet, data, oob_data);
+		call->result = std::format("job {:d} running: {:d}%", it->first, it->second.progress);
+		return;
+	}
 
-			if(command_response->packetised)
-				cli_stats_commands_received_packet++;
-			else
-				cli_stats_commands_received_raw++;
+	call->result.swap(it->second.result);
+	call->result_oob.swap(it->second.result_oob);
 
-			try
-			{
-				call.parameter_count = 0;
+	instance.jobs.erase(it);
+}
 
-				if(data.length() == 0)
-					throw(transient_exception("ERROR: empty line"));
+void Command::job_cancel(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+	std::scoped_lock<std::mutex> lock(instance.jobs_mutex);
+	std::map<unsigned int, job_t>::iterator it;
 
-				this->alias_expand(data);
+	if((it = instance.jobs.find(call->parameters[0].unsigned_int)) == instance.jobs.end())
+		throw(transient_exception(std::format("job-cancel: job {:d} not found", call->parameters[0].unsigned_int)));
 
-				command.clear();
+	if(it->second.state != job_running)
+	{
+		call->result = std::format("job {:d} already {}", it->first, job_state_to_string.at(it->second.state));
+		return;
+	}
 
-				for(data_iterator = data.begin(); data_iterator != data.end(); data_iterator++)
-					if(*data_iterator > ' ')
-						command.append(1, *data_iterator);
-					else
-						break;
+	it->second.cancel = true;
 
-				for(ix = 0;; ix++)
-				{
-					cli_command = &cli_commands[ix];
+	call->result = std::format("job {:d}: cancel requested", it->first);
+}
 
-					if(!cli_command->name || (command == cli_command->name))
-						break;
+// Scheduled jobs are run from a single task on absolute deadlines: the next deadline is derived
+// from the previous deadline, not from the moment the job ran, so execution time does not make it drift.
+// Interval deadlines are kept on the esp_timer clock, cron deadlines are computed from the wall clock
+// (and only once it has been set) and then converted to the esp_timer clock.
+// Deadlines that have passed completely while a job was late are skipped and counted as missed.
 
-					if(cli_command->alias && (command == cli_command->alias))
-						break;
-				}
+bool Command::schedule_cron_parse(std::string_view spec, int max, schedule_cron_field_t &field)
+{
+	unsigned int value;
 
-				if(!cli_command->name)
-					throw(transient_exception(std::format("ERROR: unknown command \"{}\"", command)));
+	field.value = -1;
+	field.step = 1;
 
-				count = cli_command->parameters_description.count;
+	if(spec == "*")
+		return(true);
 
-				if(count > parameters_size)
-					throw(hard_exception("Command::run_receive_queue: parameter count > parameters_size"));
+	try
+	{
+		if(spec.starts_with("*/"))
+		{
+			value = std::stoul(std::string(spec.substr(2)));
 
-				for(current = 0; current < count; current++)
-				{
-					parameter_description = &cli_command->parameters_description.entries[current];
-					parameter = &call.parameters[current];
+			if((value < 1) || (value > static_cast<unsigned int>(max)))
+				return(false);
 
-					parameter->type = cli_parameter_none;
-					parameter->has_value = 0;
+			field.step = value;
+			return(true);
+		}
 
-					for(; data_iterator != data.end(); data_iterator++)
-						if(*data_iterator > ' ')
-							break;
+		value = std::stoul(std::string(spec));
+	}
+	catch(...)
+	{
+		return(false);
+	}
 
-					if(data_iterator == data.end())
-					{
-						if(!parameter_description->value_required)
-							continue;
-						else
-							throw(transient_exception(std::format("ERROR: missing required parameter {:d}", current + 1)));
-					}
-					else
-					{
-						call.parameter_count++;
+	if(value >= static_cast<unsigned int>(max))
+		return(false);
 
-						parameter->str.clear();
+	field.value = value;
 
-						for(; data_iterator != data.end(); data_iterator++)
-							if(*data_iterator > ' ')
-								parameter->str.append(1, *data_iterator);
-							else
-								break;
+	return(true);
+}
 
-						switch(parameter_description->type)
-						{
-							case(cli_parameter_none):
-							case(cli_parameter_size):
-							{
-								throw(transient_exception(std::format("ERROR: parameter with invalid type {:d}", static_cast<int>(parameter_description->type))));
-							}
+std::string Command::schedule_cron_string(const schedule_cron_field_t &field)
+{
+	if(field.value >= 0)
+		return(std::format("{:d}", field.value));
 
-							case(cli_parameter_unsigned_int):
-							{
-								unsigned int value;
-
-								try
-								{
-									value = std::stoul(parameter->str, nullptr, parameter_description->base);
-								}
-								catch(...)
-								{
-									throw(transient_exception(std::format("ERROR: invalid unsigned integer value: {}", parameter->str)));
-								}
-
-								if((parameter_description->lower_bound_required) && (value < parameter_description->unsigned_int.lower_bound))
-									throw(transient_exception(std::format("ERROR: invalid unsigned integer value: {:d}, smaller than lower bound: {:d}",
-											value, parameter_description->unsigned_int.lower_bound)));
-
-								if((parameter_description->upper_bound_required) && (value > parameter_description->unsigned_int.upper_bound))
-									throw(transient_exception(std::format("ERROR: invalid unsigned integer value: {:d}, larger than upper bound: {:d}",
-											value, parameter_description->unsigned_int.upper_bound)));
-
-								parameter->type = cli_parameter_unsigned_int;
-								parameter->has_value = 1;
-								parameter->unsigned_int = value;
-
-								break;
-							}
+	if(field.step > 1)
+		return(std::format("*/{:d}", field.step));
 
-							case(cli_parameter_signed_int):
-							{
-								int value;
-
-								try
-								{
-									value = std::stol(parameter->str, nullptr, parameter_description->base);
-								}
-								catch(...)
-								{
-									throw(transient_exception(std::format("ERROR: invalid signed integer value: {}", parameter->str)));
-								}
-
-								if((parameter_description->lower_bound_required) && (value < parameter_description->signed_int.lower_bound))
-									throw(transient_exception(std::format("ERROR: invalid signed integer value: {:d}, smaller than lower bound: {:d}",
-											value, parameter_description->signed_int.lower_bound)));
-
-								if((parameter_description->upper_bound_required) && (value > parameter_description->signed_int.upper_bound))
-									throw(transient_exception(std::format("ERROR: invalid signed integer value: {:d}, larger than upper bound: {:d}",
-											value, parameter_description->signed_int.upper_bound)));
-
-								parameter->type = cli_parameter_signed_int;
-								parameter->has_value = 1;
-								parameter->signed_int = value;
-
-								break;
-							}
+	return("*");
+}
 
-							case(cli_parameter_float):
-							{
-								float value;
-
-								try
-								{
-									value = std::stod(parameter->str, nullptr);
-								}
-								catch(...)
-								{
-									throw(transient_exception(std::format("ERROR: invalid float value: {}", parameter->str)));
-								}
-
-								if((parameter_description->lower_bound_required) && (value < parameter_description->fp.lower_bound))
-									throw(transient_exception(std::format("ERROR: invalid float value: {:f}, smaller than lower bound: {:f}",
-											value, parameter_description->fp.lower_bound)));
-
-								if((parameter_description->upper_bound_required) && (value > parameter_description->fp.upper_bound))
-									throw(transient_exception(std::format("ERROR: invalid float value: {:f}, larger than upper bound: {:f}",
-											value, parameter_description->fp.upper_bound)));
-
-								parameter->type = cli_parameter_float;
-								parameter->has_value = 1;
-								parameter->fp = value;
-
-								break;
-							}
+bool Command::schedule_cron_match(const schedule_cron_field_t &field, int value)
+{
+	if(field.value >= 0)
+		return(value == field.value);
 
-							case(cli_parameter_string):
-							{
-								unsigned int length;
+	return((value % field.step) == 0);
+}
 
-								length = parameter->str.length();
+void Command::schedule_arm(schedule_job_t &job, std::int64_t now)
+{
+	struct timespec wall;
+	time_t candidate;
+	struct tm tm;
+	unsigned int minute;
 
-								if((parameter_description->lower_bound_required) && (length < parameter_description->string.lower_length_bound))
-									throw(transient_exception(std::format("ERROR: invalid string length: {:d}, smaller than lower bound: {:d}",
-											length, parameter_description->string.lower_length_bound)));
+	if(job.interval_ms)
+	{
+		job.deadline = job.armed ? job.deadline + (job.interval_ms * 1000LL) : now + (job.interval_ms * 1000LL);
+		job.armed = true;
+
+		if(job.deadline <= now)
+		{
+			std::int64_t skip = ((now - job.deadline) / (job.interval_ms * 1000LL)) + 1;
+
+			job.missed += skip;
+			job.deadline += skip * job.interval_ms * 1000LL;
+		}
+
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &wall);
+
+	if(wall.tv_sec < schedule_clock_valid)
+	{
+		job.deadline = now + schedule_idle_usec;
+		job.armed = false;
+		return;
+	}
+
+	// after running, start looking from the minute the job was due, not from the time it actually ran,
+	// so running late doesn't skip the next minute and a wall clock that is slightly behind can't make it run twice;
+	// minutes that have passed already are counted as missed
+
+	if(job.armed && job.wall_due && (job.wall_due > (wall.tv_sec - (24 * 60 * 60))))
+		candidate = job.wall_due;
+	else
+	{
+		candidate = wall.tv_sec;
+		localtime_r(&candidate, &tm);
+		candidate -= tm.tm_sec;
+	}
+
+	for(minute = 0; minute < (2 * 24 * 60); minute++)
+	{
+		candidate += 60;
+		localtime_r(&candidate, &tm);
+
+		if(!schedule_cron_match(job.minute, tm.tm_min) || !schedule_cron_match(job.hour, tm.tm_hour))
+			continue;
+
+		if(candidate > wall.tv_sec)
+			break;
+
+		job.missed++;
+	}
+
+	job.deadline = now + ((candidate - wall.tv_sec) * 1000000LL) - (wall.tv_nsec / 1000);
+	job.wall_due = candidate;
+	job.armed = true;
+}
+
+void Command::schedule_add(const std::string &name, schedule_job_t &job)
+{
+	job.armed = false;
+	job.deadline = 0;
+	job.wall_due = 0;
+	job.fired = 0;
+	job.missed = 0;
+	job.lateness = {};
+
+	schedule_arm(job, esp_timer_get_time());
+
+	this->schedule_mutex.lock();
+
+	if((this->schedule_jobs.size() >= schedule_jobs_max) && !this->schedule_jobs.contains(name))
+	{
+		this->schedule_mutex.unlock();
+		throw(transient_exception(std::format("schedule: too many jobs ({:d})", schedule_jobs_max)));
+	}
+
+	this->schedule_jobs[name] = job;
+
+	this->schedule_mutex.unlock();
+
+	if(this->schedule_task)
+		xTaskNotifyGive(this->schedule_task);
+}
+
+void Command::schedule_every(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+	schedule_job_t job;
+
+	job.command = call->parameters[2].str;
+	job.interval_ms = call->parameters[1].unsigned_int;
+	job.minute = { -1, 1 };
+	job.hour = { -1, 1 };
+
+	instance.schedule_add(call->parameters[0].str, job);
+
+	call->result = std::format("schedule: {} runs \"{}\" every {:d} ms", call->parameters[0].str, job.command, job.interval_ms);
+}
+
+void Command::schedule_cron(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+	schedule_job_t job;
+
+	if(!schedule_cron_parse(call->parameters[1].str, 60, job.minute))
+		throw(transient_exception(std::format("schedule: invalid minute specification: {}", call->parameters[1].str)));
+
+	if(!schedule_cron_parse(call->parameters[2].str, 24, job.hour))
+		throw(transient_exception(std::format("schedule: invalid hour specification: {}", call->parameters[2].str)));
+
+	job.command = call->parameters[3].str;
+	job.interval_ms = 0;
+
+	instance.schedule_add(call->parameters[0].str, job);
+
+	call->result = std::format("schedule: {} runs \"{}\" at minute {} hour {}", call->parameters[0].str, job.command,
+			schedule_cron_string(job.minute), schedule_cron_string(job.hour));
+}
+
+void Command::schedule_remove(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+	std::scoped_lock<std::mutex> lock(instance.schedule_mutex);
+
+	if(!instance.schedule_jobs.erase(call->parameters[0].str))
+		throw(transient_exception(std::format("schedule: job {} not found", call->parameters[0].str)));
+
+	call->result = std::format("schedule: {} removed", call->parameters[0].str);
+}
+
+void Command::run_scheduler()
+{
+	std::deque<std::pair<std::string, std::string>> due;
+	std::int64_t now, next, delay;
+	command_response_t *command_response;
+	TickType_t ticks;
+
+	this->schedule_task = xTaskGetCurrentTaskHandle();
+
+	for(;;)
+	{
+		now = esp_timer_get_time();
+		next = now + schedule_idle_usec;
+
+		this->schedule_mutex.lock();
+
+		for(auto &entry : this->schedule_jobs)
+		{
+			schedule_job_t &job = entry.second;
+
+			if(job.deadline <= now)
+			{
+				if(job.armed)
+				{
+					latency_record(job.lateness, now - job.deadline);
+					job.fired++;
+					due.push_back(std::make_pair(entry.first, job.command));
+				}
+
+				schedule_arm(job, now);
+			}
+
+			if(job.deadline < next)
+				next = job.deadline;
+		}
+
+		this->schedule_mutex.unlock();
+
+		for(const auto &job : due)
+		{
+			if(this->schedule_script(job.first, job.second))
+				continue;
+
+			command_response = this->response_pool_get();
+
+			command_response->source = cli_source_script;
+			command_response->mtu = 120;
+			command_response->packetised = 0;
+			command_response->packet = job.second;
+			command_response->script.name = job.first;
+			command_response->script.task = this->schedule_task;
+
+			this->receive_queue_push(command_response, false);
+		}
+
+		due.clear();
+
+		// replies to the submitted commands notify this task as well, which just causes the deadlines to be re-evaluated
+
+		if((delay = next - esp_timer_get_time()) > 0)
+		{
+			ticks = (delay + (portTICK_PERIOD_MS * 1000) - 1) / (portTICK_PERIOD_MS * 1000);
+			ulTaskNotifyTake(pdTRUE, ticks);
+		}
+	}
+}
+
+// Scheduled "run" commands don't go through command_run, which would start a new thread every time the job fires,
+// but are handed to the "cmd sched run" thread instead, which runs them one after another.
+
+bool Command::schedule_script(const std::string &name, const std::string &command_line)
+{
+	std::string line, command;
+	const cli_command_t *cli_command;
+
+	line = command_line;
+	this->alias_expand(line);
+	CliParser::command(line, command);
+
+	if(!(cli_command = this->find_command(command)) || (cli_command->function != Command::command_run))
+		return(false);
+
+	this->schedule_mutex.lock();
+
+	if(this->schedule_scripts.size() >= schedule_scripts_max)
+		this->schedule_scripts_dropped++;
+	else
+		this->schedule_scripts.push_back(std::make_pair(name, line));
+
+	this->schedule_mutex.unlock();
+
+	this->schedule_scripts_condition.notify_one();
+
+	return(true);
+}
+
+void Command::run_schedule_scripts()
+{
+	std::unique_lock<std::mutex> lock(this->schedule_mutex, std::defer_lock);
+	std::string name, line;
+	string_deque_t words;
+	std::shared_ptr<const script_program_t> program;
+	script_state_t *state;
+	size_t start, end;
+
+	for(;;)
+	{
+		lock.lock();
+
+		this->schedule_scripts_condition.wait(lock, [this]() { return(!this->schedule_scripts.empty()); });
+
+		name = this->schedule_scripts.front().first;
+		line = this->schedule_scripts.front().second;
+		this->schedule_scripts.pop_front();
+		this->schedule_scripts_run++;
+
+		lock.unlock();
+
+		words.clear();
+
+		for(start = line.find_first_not_of(" \t"); start != std::string::npos; start = line.find_first_not_of(" \t", end))
+		{
+			end = line.find_first_of(" \t", start);
+			words.push_back(line.substr(start, end - start));
+		}
+
+		words.pop_front();
+
+		if(words.empty() || !(program = this->script_load(words.front())))
+		{
+			this->log << std::format("schedule: {}: script {} not found", name, words.empty() ? "" : words.front());
+			continue;
+		}
+
+		state = script_state_new(words.front(), program);
+		words.pop_front();
+		state->parameter = words;
+
+		this->script_thread_runner(state);
+	}
+}
+
+void Command::script_stop(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+	int filter;
+
+	if(call->parameter_count == 0)
+		filter = -1;
+	else
+		filter = call->parameters[0].unsigned_int;
+
+	call->result += "Stopping script threads:";
+
+	instance.script_thread_mutex.lock();
+
+	for(auto &script : instance.script_thread_map)
+	{
+		if((script.first == filter) || (filter < 0))
+		{
+			script.second.stop = true;
+			call->result += std::format("\nscript \"{}\" [{:d}] closing down", script.second.command_line, script.first);
+		}
+	}
+
+	instance.script_thread_mutex.unlock();
+}
+
+void Command::i2c_speed(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+	int module;
+	int speed;
+
+	module = call->parameters[0].unsigned_int;
+
+	if(call->parameter_count > 1)
+		instance.i2c.speed(module, call->parameters[1].unsigned_int);
+
+	speed = instance.i2c.speed(module);
+
+	call->result = std::format("i2c speed of module {:d} is {:d} kHz", module, speed);
+}
+
+void Command::i2c_probe(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+
+	call->result = std::format("probe {:d}/{:d}/{:#04x}: {}",
+			call->parameters[0].unsigned_int,
+			call->parameters[1].unsigned_int,
+			call->parameters[2].unsigned_int,
+			instance.i2c.probe(call->parameters[0].unsigned_int, call->parameters[1].unsigned_int, call->parameters[2].unsigned_int) ? "ok" : "not found");
+}
+
+void Command::i2c_info(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+
+	call->result = "I2C INFO";
+	instance.i2c.info(call->result);
+}
+
+void Command::sensor_dump(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+
+	call->result = "SENSORS DUMP\n";
+
+	if(call->parameter_count == 0)
+		call->result += instance.sensors.dump();
+	else
+		call->result += instance.sensors.dump(call->parameters[0].unsigned_int);
+}
+
+void Command::sensor_info(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+
+	if(call->parameter_count == 0)
+		call->result += instance.sensors.info();
+	else
+		call->result += instance.sensors.info(call->parameters[0].unsigned_int);
+}
+
+void Command::sensor_json(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+
+	call->result += instance.sensors.json();
+}
+
+void Command::sensor_stats(cli_command_call_t *call)
+{
+	auto& instance = Command::get();
+
+	call->result = "SENSORS STATS\n";
+	call->result += instance.sensors.stats();
+}
+
+command_response_t *Command::response_pool_get()
+{
+	command_response_t *command_response;
+	int in_use;
+
+	this->response_pool_mutex.lock();
+
+	if(this->response_pool_free_count == 0)
+	{
+		this->response_pool_stats_exhausted++;
+		this->response_pool_mutex.unlock();
+
+		command_response = new command_response_t;
+		command_response->pooled = 0;
+	}
+	else
+	{
+		command_response = this->response_pool_free[--this->response_pool_free_count];
+
+		if((in_use = response_pool_size - this->response_pool_free_count) > this->response_pool_stats_in_use_max)
+			this->response_pool_stats_in_use_max = in_use;
+
+		this->response_pool_mutex.unlock();
+	}
+
+	command_response->source = cli_source_none;
+	command_response->source_key = 0;
+	command_response->mtu = 0;
+	command_response->packet.clear();
+	command_response->oob.clear();
+	command_response->request_id.clear();
+	command_response->sequence = 0;
+	command_response->packetised = 0;
+	command_response->more = 0;
+	command_response->bulk = 0;
+	command_response->busy = 0;
+	command_response->deferred = 0;
+	command_response->chunked = 0;
+	command_response->command_index = -1;
+	command_response->time_received = 0;
+	command_response->time_send_queued = 0;
+	command_response->bt.connection_handle = 0;
+	command_response->bt.attribute_handle = 0;
+	command_response->ip.address.sin6_length = 0;
+	command_response->ip.connection = 0;
+	command_response->ip.fragmented = false;
+	command_response->script.name.clear();
+	command_response->script.task = nullptr;
+
+	return(command_response);
+}
+
+command_response_t *Command::response_pool_clone(const command_response_t *original)
+{
+	command_response_t *command_response = this->response_pool_get();
+
+	command_response->source = original->source;
+	command_response->source_key = original->source_key;
+	command_response->mtu = original->mtu;
+	command_response->packetised = original->packetised;
+	command_response->chunked = original->chunked;
+	command_response->request_id = original->request_id;
+	command_response->bt = original->bt;
+	command_response->ip = original->ip;
+	command_response->script.name = original->script.name;
+	command_response->script.task = original->script.task;
+
+	return(command_response);
+}
+
+void Command::response_pool_put(command_response_t *command_response)
+{
+	if(!command_response->pooled)
+	{
+		delete command_response;
+		return;
+	}
+
+	if(command_response->packet.capacity() > response_pool_retain_size)
+		std::string().swap(command_response->packet);
+
+	if(command_response->oob.capacity() > response_pool_retain_size)
+		std::string().swap(command_response->oob);
+
+	this->response_pool_mutex.lock();
+
+	if(this->response_pool_free_count >= response_pool_size)
+	{
+		this->response_pool_mutex.unlock();
+		throw(hard_exception("Command::response_pool_put: pool overflow"));
+	}
+
+	this->response_pool_free[this->response_pool_free_count++] = command_response;
+
+	this->response_pool_mutex.unlock();
+}
+
+unsigned int Command::source_key(const command_response_t *command_response)
+{
+	std::string_view id;
+
+	switch(command_response->source)
+	{
+		case(cli_source_bt):
+		{
+			id = std::string_view(reinterpret_cast<const char *>(&command_response->bt.connection_handle), sizeof(command_response->bt.connection_handle));
+			break;
+		}
+
+		case(cli_source_wlan_tcp):
+		{
+			id = std::string_view(reinterpret_cast<const char *>(&command_response->ip.connection), sizeof(command_response->ip.connection));
+			break;
+		}
+
+		case(cli_source_wlan_udp):
+		{
+			id = std::string_view(command_response->ip.address.sin6_addr, command_response->ip.address.sin6_length);
+			break;
+		}
+
+		case(cli_source_script):
+		{
+			id = std::string_view(reinterpret_cast<const char *>(&command_response->script.task), sizeof(command_response->script.task));
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+
+	return((std::hash<std::string_view>()(id) * cli_source_size) + command_response->source);
+}
+
+const char *Command::source_name(cli_source_t source)
+{
+	switch(source)
+	{
+		case(cli_source_bt): return("bt");
+		case(cli_source_console): return("console");
+		case(cli_source_wlan_tcp): return("tcp");
+		case(cli_source_wlan_udp): return("udp");
+		case(cli_source_script): return("script");
+		default: return("unknown");
+	}
+}
+
+// Requests are queued in two lanes: interactive and bulk (commands flagged as such in the command table).
+// Interactive requests are always dispatched first and bulk requests may occupy at most all but one
+// of the workers, so a long upload can't hold up console or BT commands. A request is only eligible
+// if its source has no other request in progress and no older request queued in the other lane,
+// which keeps the replies per source in order while unrelated sources run in parallel.
+
+bool Command::receive_queue_bulk(const std::string &data)
+{
+	const cli_command_t *cli_command;
+	unsigned int offset, command_index;
+	std::string::size_type delimiter;
+	std::string command;
+
+	if(CliParser::binary(data))
+	{
+		try
+		{
+			command_index = CliParser::binary_command(data, offset);
+		}
+		catch(const transient_exception &)
+		{
+			return(false);
+		}
+
+		return((command_index < this->command_stats_size) && cli_commands[command_index].flags.bulk);
+	}
+
+	// classify on the command the alias expands to, as execute() runs that one, for a batch on its first command
+
+	command = data.substr(data.starts_with(batch_marker) ? batch_marker.size() : 0);
+	command.resize(std::min(command.find('\n'), command.size()));
+	this->alias_expand(command);
+
+	if((delimiter = command.find_first_of(" \t")) != std::string::npos)
+		command.resize(delimiter);
+
+	if(!(cli_command = this->find_command(command)))
+		return(false);
+
+	return(cli_command->flags.bulk);
+}
+
+// receive_queue_mutex must be held
+
+bool Command::receive_queue_pending(unsigned int key)
+{
+	if(this->receive_queue_active_sources.contains(key))
+		return(true);
+
+	for(const auto &lane : this->receive_queue)
+		for(const auto *other : lane)
+			if(other->source_key == key)
+				return(true);
+
+	return(false);
+}
+
+// Busy replies are counted per client (source key), only the busy_sources_max most recent clients are kept.
+// receive_queue_mutex must be held.
+
+void Command::receive_queue_busy_count(const command_response_t *command_response)
+{
+	std::map<unsigned int, busy_source_t>::iterator it, oldest;
+
+	if(((it = this->receive_queue_busy.find(command_response->source_key)) == this->receive_queue_busy.end()))
+	{
+		if(this->receive_queue_busy.size() >= busy_sources_max)
+		{
+			oldest = std::min_element(this->receive_queue_busy.begin(), this->receive_queue_busy.end(),
+					[](const auto &a, const auto &b) { return(a.second.time_last < b.second.time_last); });
+			this->receive_queue_busy.erase(oldest);
+		}
+
+		it = this->receive_queue_busy.emplace(command_response->source_key, busy_source_t { command_response->source, 0, 0, 0 }).first;
+	}
+
+	it->second.replies++;
+	it->second.time_last = esp_timer_get_time();
+}
+
+bool Command::receive_queue_eligible(unsigned int lane, const command_response_t *command_response)
+{
+	if(this->receive_queue_active_sources.contains(command_response->source_key))
+		return(false);
+
+	for(const auto *other : this->receive_queue[(lane + 1) % receive_lane_size])
+		if((other->source_key == command_response->source_key) && (other->sequence < command_response->sequence))
+			return(false);
+
+	return(true);
+}
 
-								if((parameter_description->upper_bound_required) && (length > parameter_description->string.upper_length_bound))
-									throw(transient_exception(std::format("ERROR: invalid string length: {:d}, larger than upper bound: {:d}",
-											length, parameter_description->string.upper_length_bound)));
+command_response_t *Command::receive_queue_pop()
+{
+	std::unique_lock<std::mutex> lock(this->receive_queue_mutex);
+	std::deque<command_response_t *>::iterator it;
+	command_response_t *command_response = nullptr;
+	unsigned int lane, bulk_limit;
+
+	bulk_limit = (this->workers > 1) ? this->workers - 1 : 1;
+
+	for(;;)
+	{
+		for(lane = 0; lane < receive_lane_size; lane++)
+		{
+			for(it = this->receive_queue[lane].begin(); it != this->receive_queue[lane].end(); it++)
+				if(this->receive_queue_eligible(lane, *it))
+					break;
+
+			if(it == this->receive_queue[lane].end())
+				continue;
+
+			if((lane == receive_lane_bulk) && (this->receive_queue_bulk_active >= bulk_limit))
+			{
+				if(!(*it)->deferred)
+				{
+					(*it)->deferred = 1;
+					this->receive_lane_stats[lane].deferred++;
+				}
+
+				continue;
+			}
+
+			command_response = *it;
+			this->receive_queue[lane].erase(it);
+			break;
+		}
+
+		if(command_response)
+			break;
+
+		this->receive_queue_condition.wait(lock);
+	}
+
+	if(command_response->bulk)
+		this->receive_queue_bulk_active++;
+
+	if(command_response->busy)
+		this->receive_queue_busy_queued--;
+
+	this->receive_lane_stats[lane].dispatched++;
+	this->receive_queue_active_sources.insert(command_response->source_key);
+
+	lock.unlock();
+	this->receive_queue_condition.notify_all();
+
+	if(!command_response->busy)
+		this->cli_stats_commands_received++;
+
+	return(command_response);
+}
+
+void Command::receive_queue_release(unsigned int key, bool bulk)
+{
+	this->receive_queue_mutex.lock();
+	this->receive_queue_active_sources.erase(key);
+
+	if(bulk && (this->receive_queue_bulk_active > 0))
+		this->receive_queue_bulk_active--;
+
+	this->receive_queue_mutex.unlock();
+
+	this->receive_queue_condition.notify_all();
+}
+
+// Returns false if block is false and the send queue is full, the caller then still owns command_response.
+
+bool Command::send_queue_push(command_response_t *command_response, bool block)
+{
+	bool packetised;
+
+	if(!this->send_queue_handle)
+		throw(hard_exception("Command::send_queue_push: queue inactive"));
+
+	if(!command_response)
+		throw(hard_exception("Command::send_queue_push: invalid argument"));
+
+	packetised = command_response->packetised; // once queued, it may have been sent and recycled already
+
+	if(xQueueSendToBack(this->send_queue_handle, &command_response, block ? portMAX_DELAY : 0) != pdTRUE)
+		return(false);
+
+	if(packetised)
+		this->cli_stats_replies_sent_packet++;
+	else
+		this->cli_stats_replies_sent_raw++;
+
+	this->cli_stats_replies_sent++;
+
+	return(true);
+}
+
+// Send a reply that is larger than the mtu as a sequence of packets of exactly mtu bytes of payload.
+// The reply ends with the first packet that is shorter, which may be empty.
+
+void Command::send_queue_push_chunked(command_response_t *command_response, const std::string &result, const std::string &prefix)
+{
+	command_response_t *chunk_response;
+	unsigned int offset, length, chunk_size;
+	std::string chunk;
+
+	cli_stats_replies_chunked++;
+
+	chunk_size = command_response->mtu - prefix.size();
+	chunk.reserve(command_response->mtu);
+
+	for(offset = 0;; offset += length)
+	{
+		length = std::min(static_cast<unsigned int>(result.size()) - offset, chunk_size);
+
+		chunk.assign(prefix);
+		chunk.append(result, offset, length);
+
+		if(length < chunk_size)
+		{
+			command_response->more = 0;
+			command_response->packet = Packet::encapsulate(command_response->packetised, chunk, "");
+			this->send_queue_push(command_response);
+			break;
+		}
+
+		chunk_response = this->response_pool_clone(command_response);
+		chunk_response->more = 1;
+		chunk_response->packet = Packet::encapsulate(chunk_response->packetised, chunk, "");
+		this->send_queue_push(chunk_response);
+	}
+}
+
+// A request may start with "@<id> ", the id (up to request_id_length_max characters) is removed
+// from the request and put in front of every packet of the reply, so clients that have several
+// requests outstanding can match the replies, which may arrive in a different order.
+// An id that ends in '+' (which is not part of the id, "@+ " is a request without id) asks for a reply
+// that is larger than the mtu to be sent in chunks, like cmd.chunked does for all requests.
+
+void Command::request_id_strip(command_response_t *command_response)
+{
+	std::string::size_type delimiter;
+
+	if(command_response->packet.empty() || (command_response->packet[0] != '@'))
+		return;
+
+	delimiter = command_response->packet.find(' ');
+
+	if((delimiter == std::string::npos) || (delimiter < 2) || (delimiter > (request_id_length_max + 2)))
+		return;
+
+	command_response->request_id.assign(command_response->packet, 1, delimiter - 1);
+
+	if(command_response->request_id.back() == request_chunked_marker)
+	{
+		command_response->request_id.pop_back();
+		command_response->chunked = 1;
+	}
+
+	if(command_response->request_id.size() > request_id_length_max)
+	{
+		command_response->request_id.clear();
+		command_response->chunked = 0;
+		return;
+	}
+
+	command_response->packet.erase(0, delimiter + 1);
+
+	if(!command_response->request_id.empty())
+		cli_stats_commands_received_request_id++;
+}
+
+std::string Command::request_id_prefix(const command_response_t *command_response)
+{
+	if(command_response->request_id.empty())
+		return("");
+
+	return(std::format("@{} ", command_response->request_id));
+}
+
+command_response_t *Command::send_queue_pop()
+{
+	command_response_t *command_response = nullptr;
+
+	xQueueReceive(send_queue_handle, &command_response, portMAX_DELAY);
+
+	return(command_response);
+}
+
+// The send thread is the only reader of the send queue, so an entry peeked at is still there when it's popped.
+
+command_response_t *Command::send_queue_peek()
+{
+	command_response_t *command_response = nullptr;
+
+	if(xQueuePeek(send_queue_handle, &command_response, 0) != pdTRUE)
+		return(nullptr);
+
+	return(command_response);
+}
+
+// Results of commands flagged idempotent are cached for a short time (cmd.cache_ttl ms), keyed on command, mtu and parameters.
+// A request for a result that is being generated at that moment waits for it instead of running the command again (single-flight).
+// Returns true if the call has been answered from the cache, otherwise the caller must run the command and call result_cache_put.
+
+bool Command::result_cache_get(const std::string &key, cli_command_call_t &call)
+{
+	std::unique_lock<std::mutex> lock(this->result_cache_mutex);
+	std::map<std::string, result_cache_entry_t>::iterator it, oldest;
+	std::int64_t time_request;
+	bool waited = false;
+
+	time_request = esp_timer_get_time();
+
+	while((it = this->result_cache.find(key)) != this->result_cache.end())
+	{
+		if(it->second.in_flight)
+		{
+			waited = true;
+			this->result_cache_condition.wait(lock);
+			continue;
+		}
+
+		if(it->second.valid && (((esp_timer_get_time() - it->second.time_stored) <= (this->result_cache_ttl_ms * 1000LL)) || (it->second.time_stored >= time_request)))
+		{
+			call.result = it->second.result;
+			call.result_oob = it->second.result_oob;
+
+			if(waited)
+				this->result_cache_coalesced++;
+			else
+				this->result_cache_hits++;
+
+			return(true);
+		}
+
+		break;
+	}
+
+	this->result_cache_misses++;
 
-								parameter->type = cli_parameter_string;
-								parameter->has_value = 1;
+	if((it == this->result_cache.end()) && (this->result_cache.size() >= result_cache_size))
+	{
+		for(oldest = this->result_cache.end(), it = this->result_cache.begin(); it != this->result_cache.end(); it++)
+			if(!it->second.in_flight && ((oldest == this->result_cache.end()) || (it->second.time_stored < oldest->second.time_stored)))
+				oldest = it;
+
+		if(oldest != this->result_cache.end())
+			this->result_cache.erase(oldest);
+	}
+
+	result_cache_entry_t &entry = this->result_cache[key];
+
+	entry.in_flight = true;
+	entry.valid = false;
+
+	return(false);
+}
+
+void Command::result_cache_put(const std::string &key, const cli_command_call_t *call)
+{
+	std::unique_lock<std::mutex> lock(this->result_cache_mutex);
+	result_cache_entry_t &entry = this->result_cache[key];
+
+	entry.in_flight = false;
+	entry.valid = !!call;
+
+	if(call)
+	{
+		entry.time_stored = esp_timer_get_time();
+		entry.result = call->result;
+		entry.result_oob = call->result_oob;
+	}
+	else
+	{
+		entry.result.clear();
+		entry.result_oob.clear();
+	}
+
+	lock.unlock();
+	this->result_cache_condition.notify_all();
+}
+
+int Command::execute(const command_response_t *command_response, std::string &data, cli_command_call_t &call, bool *failed)
+{
+	std::string::const_iterator			data_iterator;
+	std::string							command;
+	unsigned int						ix, offset;
+	const cli_command_t					*cli_command = nullptr;
+	int									command_index = -1;
+	std::int64_t						time_start;
+	std::int64_t						time_execute = 0;
+	bool								binary;
+	std::string							cache_key;
+
+	if(failed)
+		*failed = false;
+
+	try
+	{
+		call.parameter_count = 0;
+
+		if(data.length() == 0)
+			throw(transient_exception("ERROR: empty line"));
+
+		if((binary = CliParser::binary(data)))
+		{
+			if((ix = CliParser::binary_command(data, offset)) >= this->command_stats_size)
+				throw(transient_exception(std::format("ERROR: unknown command index {:d}", ix)));
+
+			cli_command = &cli_commands[ix];
+			cli_stats_commands_received_binary++;
+		}
+		else
+		{
+			this->alias_expand(data);
+
+			data_iterator = CliParser::command(data, command);
+
+			if(!(cli_command = this->find_command(command)))
+				throw(transient_exception(std::format("ERROR: unknown command \"{}\"", command)));
+		}
+
+		command_index = cli_command - cli_commands;
+		time_start = esp_timer_get_time();
+
+		this->command_stats_mutex.lock();
+		this->command_stats[command_index].calls++;
+		latency_record(this->command_stats[command_index].queue, time_start - command_response->time_received);
+		this->command_stats_mutex.unlock();
+
+		if(binary)
+			CliParser::parameters_binary(cli_command->parameters_description, data, offset, call);
+		else
+			CliParser::parameters(cli_command->parameters_description, data, data_iterator, call);
+
+		call.source =			command_response->source;
+		call.mtu =				command_response->mtu;
+		call.request_id =		command_response->request_id;
+		call.result.clear();
+		call.result_oob.clear();
+
+		auto run = [this, cli_command, &call]()
+		{
+			if(cli_command->flags.serialise)
+			{
+				std::scoped_lock<std::mutex> serialise_lock(this->serialise_mutex);
+				cli_command->function(&call);
+			}
+			else
+				cli_command->function(&call);
+		};
+
+		time_execute = esp_timer_get_time();
+
+		if(cli_command->flags.idempotent)
+		{
+			cache_key = std::format("{:d} {:d} {}", command_index, call.mtu, binary ? data.substr(offset) : std::string(data_iterator, data.cend()));
+
+			if(!this->result_cache_get(cache_key, call))
+			{
+				try
+				{
+					run();
+				}
+				catch(...)
+				{
+					this->result_cache_put(cache_key, nullptr);
+					throw;
+				}
+
+				this->result_cache_put(cache_key, &call);
+			}
+		}
+		else
+			run();
+
+		this->command_stats_record(command_index, &cli_command_stats_t::execute, esp_timer_get_time() - time_execute);
+	}
+	catch(const transient_exception &e)
+	{
+		call.result = std::format("WARNING: {}", e.what());
+		this->log << std::format("cli: transient exception: {}", e.what());
+		call.result_oob.clear();
+
+		this->command_stats_failed(command_index, time_execute);
+
+		if(failed)
+			*failed = true;
+	}
+	catch(const hard_exception &e)
+	{
+		call.result = std::format("ERROR: {}", e.what());
+		this->log << std::format("cli: hard exception: {}", e.what());
+		call.result_oob.clear();
+
+		this->command_stats_failed(command_index, time_execute);
+
+		if(failed)
+			*failed = true;
+	}
+
+	for(ix = 0; ix < call.parameter_count; ix++)
+		call.parameters[ix].str.clear();
+
+	return(command_index);
+}
+
+// Split the text of a packet into separate commands, one per line. A command with a
+// raw string parameter takes the remainder of the packet, including newlines, as before.
+// Only packets that start with the batch marker line are split, anything else is one command,
+// so existing clients that send newlines inside a command are not affected.
+
+void Command::split_batch(const std::string &data, string_deque_t &lines)
+{
+	std::string_view remaining(data);
+	std::string line, command;
+	size_t end, delimiter;
+	const cli_command_t *cli_command;
+	const cli_parameters_description_t *parameters_description;
+
+	lines.clear();
+
+	while(!remaining.empty() && (lines.size() <= batch_size_max))
+	{
+		if((end = remaining.find('\n')) == std::string_view::npos)
+			end = remaining.length();
+
+		line = remaining.substr(0, end);
+
+		command = line;
+		this->alias_expand(command);
+
+		if((delimiter = command.find_first_of(" \t")) != std::string::npos)
+			command.resize(delimiter);
+
+		if((cli_command = this->find_command(command)))
+		{
+			parameters_description = &cli_command->parameters_description;
+
+			if((parameters_description->count > 0) && (parameters_description->entries[parameters_description->count - 1].type == cli_parameter_string_raw))
+			{
+				lines.push_back(std::string(remaining));
+				break;
+			}
+		}
+
+		remaining.remove_prefix(std::min(end + 1, remaining.length()));
+
+		if(line.find_first_not_of(" \t\r") != std::string::npos)
+			lines.push_back(line);
+	}
+}
+
+void Command::run_receive_queue()
+{
+	command_response_t					*command_response;
+	std::string							data;
+	std::string							oob_data;
+	string_deque_t						lines;
+	std::string							entry;
+	std::string							prefix;
+	unsigned int						ix, key;
+	bool								bulk;
+	cli_command_call_t					call;
+
+	try
+	{
+		for(;;)
+		{
+			command_response = receive_queue_pop();
+
+			if(command_response->busy)
+			{
+				key = command_response->source_key;
+				bulk = command_response->bulk;
+				command_response->time_send_queued = esp_timer_get_time();
+				this->send_queue_push(command_response);
+				this->receive_queue_release(key, bulk);
+				continue;
+			}
+
+			data.swap(command_response->packet);
+			oob_data.swap(command_response->oob);
+
+			if(command_response->packetised)
+				cli_stats_commands_received_packet++;
+			else
+				cli_stats_commands_received_raw++;
+
+			prefix = this->request_id_prefix(command_response);
+
+			if(command_response->packetised && data.starts_with(batch_marker))
+			{
+				data.erase(0, batch_marker.size());
+				this->split_batch(data, lines);
+			}
+			else
+				lines.clear();
+
+			if(lines.size() < 2)
+			{
+				call.oob.swap(oob_data);
+				command_response->command_index = this->execute(command_response, data, call);
+			}
+			else
+			{
+				// A batch returns one reply holding all results, each one preceded by a header line
+				// with its sequence number and length. Results that would overflow the mtu are
+				// replaced by an error. Commands are only run while that error, with its header line, still
+				// fits, the ones after that are not run and have no result. Out of band data is only
+				// supported for single commands.
 
-								break;
-							}
+				cli_stats_commands_received_batch++;
 
-							case(cli_parameter_string_raw):
-							{
-								unsigned int length;
+				if(lines.size() > batch_size_max)
+				{
+					call.result = std::format("ERROR: too many commands in batch, max: {:d}", batch_size_max);
+					call.result_oob.clear();
+				}
+				else if(!oob_data.empty())
+				{
+					call.result = "ERROR: out of band data not supported in batch";
+					call.result_oob.clear();
+				}
+				else
+				{
+					static constexpr std::string_view batch_overflow = "ERROR: batch result exceeds mtu";
+					std::string batch_result;
+					unsigned int limit = command_response->mtu - std::min(static_cast<unsigned int>(prefix.size()), command_response->mtu);
 
-								for(; data_iterator != data.end(); data_iterator++)
-									parameter->str.append(1, *data_iterator);
+					for(ix = 0; ix < lines.size(); ix++)
+					{
+						entry = std::format("{:d} {:d}\n", ix, batch_overflow.size());
 
-								length = parameter->str.length();
+						if((batch_result.size() + entry.size() + batch_overflow.size() + 1) > limit)
+							break;
 
-								if((parameter_description->lower_bound_required) && (length < parameter_description->string.lower_length_bound))
-									throw(transient_exception(std::format("ERROR: invalid raw string length: {:d}, smaller than lower bound: {:d}",
-											length, parameter_description->string.lower_length_bound)));
+						call.oob.clear();
+						this->execute(command_response, lines[ix], call);
 
-								if((parameter_description->upper_bound_required) && (length > parameter_description->string.upper_length_bound))
-									throw(transient_exception(std::format("ERROR: invalid raw string length: {:d}, larger than upper bound: {:d}",
-											length, parameter_description->string.upper_length_bound)));
+						if(!call.result_oob.empty())
+							call.result = "ERROR: out of band data not supported in batch";
 
-								parameter->type = cli_parameter_string;
-								parameter->has_value = 1;
+						entry = std::format("{:d} {:d}\n", ix, call.result.size());
 
-								break;
-							}
+						if((batch_result.size() + entry.size() + call.result.size() + 1) > limit)
+						{
+							call.result = batch_overflow;
+							entry = std::format("{:d} {:d}\n", ix, call.result.size());
 						}
-					}
-				}
 
-				if(current >= parameters_size)
-					throw(transient_exception(std::format("ERROR: too many parameters: {}", current)));
+						batch_result.append(entry);
+						batch_result.append(call.result);
+						batch_result.append(1, '\n');
+					}
 
-				if(current < cli_command->parameters_description.count)
-					throw(transient_exception("ERROR: missing parameters"));
+					call.result.swap(batch_result);
+					call.result_oob.clear();
+				}
+			}
 
-				for(; data_iterator != data.end(); data_iterator++)
-					if(*data_iterator > ' ')
-						break;
+			key = command_response->source_key;
+			bulk = command_response->bulk;
+			command_response->time_send_queued = esp_timer_get_time();
 
-				if(data_iterator != data.end())
-					throw(transient_exception("ERROR: too many parameters"));
+			if(call.result_oob.empty() && ((prefix.size() + call.result.size()) > command_response->mtu))
+			{
+				if(!command_response->packetised || command_response->chunked || this->chunked_replies)
+				{
+					this->send_queue_push_chunked(command_response, call.result, prefix);
+					this->receive_queue_release(key, bulk);
+					continue;
+				}
 
-				call.source =			command_response->source;
-				call.mtu =				command_response->mtu;
-				call.oob =				oob_data;
-				call.result.clear();
-				call.result_oob.clear();
+				// the client didn't ask for chunks, tell it the reply is incomplete
 
-				cli_command->function(&call);
-			}
-			catch(const transient_exception &e)
-			{
-				call.result = std::format("WARNING: {}", e.what());
-				this->log << std::format("cli: transient exception: {}", e.what());
-				call.result_oob.clear();
-			}
-			catch(const hard_exception &e)
-			{
-				call.result = std::format("ERROR: {}", e.what());
-				this->log << std::format("cli: hard exception: {}", e.what());
-				call.result_oob.clear();
+				call.result.resize(command_response->mtu - prefix.size() - truncated_marker.size());
+				call.result.append(truncated_marker);
+				cli_stats_replies_truncated++;
 			}
 
-			if(call.result_oob.empty() && (call.result.size() > command_response->mtu))
-				call.result.resize(command_response->mtu);
-
 			if(call.result_oob.size() > command_response->mtu)
 			{
 				call.result = std::format("ERROR: packet mtu overflow, payload: {:d}, oob: {:d}, packet overhead: {:d}, mtu: {:d}",
@@ -1965,11 +3585,12 @@ void Command::run_receive_queue()
 				call.result_oob.clear();
 			}
 
+			if(!prefix.empty())
+				call.result.insert(0, prefix);
+
 			command_response->packet = Packet::encapsulate(command_response->packetised, call.result, call.result_oob);
 			send_queue_push(command_response);
-
-			for(ix = 0; ix < call.parameter_count; ix++)
-				call.parameters[ix].str.clear();
+			receive_queue_release(key, bulk);
 		}
 	}
 	catch(const hard_exception &e)
@@ -1993,16 +3614,56 @@ void Command::run_receive_queue()
 		(void)0;
 }
 
+void Command::send_done(command_response_t *command_response)
+{
+	if(!command_response->more)
+		this->command_stats_record(command_response->command_index, &cli_command_stats_t::send, esp_timer_get_time() - command_response->time_send_queued);
+
+	if((command_response->source == cli_source_script) && !command_response->more)
+	{
+		if(!command_response->script.task)
+			throw(hard_exception("Command::send_done: invalid script task"));
+
+		xTaskNotifyGive(static_cast<TaskHandle_t>(command_response->script.task));
+		command_response->script.name[0] = '\0';
+		command_response->script.task = nullptr;
+	}
+
+	command_response->source = cli_source_none;
+	this->response_pool_put(command_response);
+}
+
 void Command::run_send_queue()
 {
-	command_response_t *command_response;
+	command_response_t *command_response, *next;
+	std::vector<command_response_t *> udp_batch;
 
 	try
 	{
+		udp_batch.reserve(send_queue_size);
+
 		for(;;)
 		{
 			command_response = this->send_queue_pop();
 
+			// UDP replies queued right behind this one are handed over in the same wakeup
+
+			if(command_response->source == cli_source_wlan_udp)
+			{
+				udp_batch.assign(1, command_response);
+
+				while((udp_batch.size() < send_queue_size) && (next = this->send_queue_peek()) && (next->source == cli_source_wlan_udp))
+					udp_batch.push_back(this->send_queue_pop());
+
+				this->udp.send(udp_batch);
+
+				for(auto *batch_response : udp_batch)
+					this->send_done(batch_response);
+
+				udp_batch.clear();
+				continue;
+			}
+
 			switch(command_response->source)
 			{
 				case(cli_source_bt):
@@ -2023,12 +3684,6 @@ void Command::run_send_queue()
 					break;
 				}
 
-				case(cli_source_wlan_udp):
-				{
-					this->udp.send(command_response);
-					break;
-				}
-
 				case(cli_source_script):
 				{
 					if(!command_response->packet.empty() && command_response->packet.back() == '\n') // FIXME
@@ -2047,18 +3702,7 @@ void Command::run_send_queue()
 				}
 			}
 
-			if(command_response->source == cli_source_script)
-			{
-				if(!command_response->script.task)
-					throw(hard_exception("Command::run_send_queue: invalid script task"));
-
-				xTaskNotifyGive(static_cast<TaskHandle_t>(command_response->script.task));
-				command_response->script.name[0] = '\0';
-				command_response->script.task = nullptr;
-			}
-
-			command_response->source = cli_source_none;
-			delete command_response;
+			this->send_done(command_response);
 			command_response = nullptr;
 		}
 	}
@@ -2083,50 +3727,355 @@ void Command::run_send_queue()
 		(void)0;
 }
 
-void Command::receive_queue_push(command_response_t *command_response)
+// Transport threads don't block when a lane is full, as that would stall (and for UDP: overflow) their socket.
+// Instead the request is answered immediately with a busy reply holding a retry hint proportional to the queue length.
+// If the same client still has a request queued or running, the busy reply would overtake that reply, so then it's
+// queued behind it instead (beyond the lane's size, at most receive_queue_size of them) and sent from a worker.
+// Console, scripts and the like pass block = true and wait for room instead.
+
+void Command::receive_queue_push(command_response_t *command_response, bool block)
 {
-	xQueueSendToBack(this->receive_queue_handle, &command_response, portMAX_DELAY);
+	std::string data, oob;
+	unsigned int lane;
+
+	Packet::decapsulate(command_response->packetised, command_response->packet, data, oob);
+	command_response->packet.swap(data);
+	command_response->oob.swap(oob);
+
+	this->request_id_strip(command_response);
+
+	command_response->bulk = this->receive_queue_bulk(command_response->packet) ? 1 : 0;
+	lane = command_response->bulk ? receive_lane_bulk : receive_lane_interactive;
+	command_response->source_key = this->source_key(command_response);
+	command_response->time_received = esp_timer_get_time();
+
+	std::unique_lock<std::mutex> lock(this->receive_queue_mutex);
+
+	if(this->receive_queue[lane].size() >= receive_queue_size)
+	{
+		if(!block)
+		{
+			unsigned int retry_ms = busy_retry_ms * this->receive_queue[lane].size();
+
+			this->receive_queue_busy_count(command_response);
+
+			command_response->busy = 1;
+			command_response->command_index = -1;
+			command_response->packet = Packet::encapsulate(command_response->packetised,
+					std::format("{}BUSY: retry after {:d} ms", this->request_id_prefix(command_response), retry_ms), "");
+
+			if(this->receive_queue_pending(command_response->source_key))
+			{
+				if(this->receive_queue_busy_queued < receive_queue_size)
+				{
+					this->receive_queue_busy_queued++;
+					command_response->sequence = this->receive_queue_sequence++;
+					this->receive_queue[lane].push_back(command_response);
+
+					lock.unlock();
+					this->receive_queue_condition.notify_all();
+					return;
+				}
+			}
+			else
+			{
+				lock.unlock();
+
+				command_response->time_send_queued = esp_timer_get_time();
+
+				if(this->send_queue_push(command_response, false))
+					return;
+
+				lock.lock();
+			}
+
+			this->receive_queue_busy_dropped++;
+
+			if(auto it = this->receive_queue_busy.find(command_response->source_key); it != this->receive_queue_busy.end())
+				it->second.dropped++;
+
+			lock.unlock();
+
+			this->response_pool_put(command_response);
+			return;
+		}
+
+		this->receive_lane_stats[lane].push_waits++;
+		this->receive_queue_condition.wait(lock, [this, lane]() { return(this->receive_queue[lane].size() < receive_queue_size); });
+	}
+
+	command_response->sequence = this->receive_queue_sequence++;
+	this->receive_queue[lane].push_back(command_response);
+
+	if(this->receive_queue[lane].size() > this->receive_lane_stats[lane].queued_max)
+		this->receive_lane_stats[lane].queued_max = this->receive_queue[lane].size();
+
+	lock.unlock();
+	this->receive_queue_condition.notify_all();
 }
 
-void Command::alias_expand(std::string &data) const
+void Command::alias_expand(std::string &data)
 {
-	std::string command;
-	std::string parameters;
 	unsigned int delimiter;
-	string_string_map::const_iterator it;
+	alias_index_t::const_iterator it;
 
-	if(data.length() == 0)
+	if(!this->aliases_active || (data.length() == 0))
 		return;
 
 	for(delimiter = 0; delimiter < data.length(); delimiter++)
-		if(data.at(delimiter) <= ' ')
+		if(data[delimiter] <= ' ')
 			break;
 
 	if(delimiter == 0)
 		return;
 
-	if(delimiter >= data.length())
-		command = data;
-	else
-		command = data.substr(0, delimiter);
+	std::scoped_lock<std::mutex> lock(this->aliases_mutex);
 
-	if((it = aliases.find(command)) == aliases.end())
+	if((it = this->aliases_resolved.find(std::string_view(data.data(), delimiter))) == this->aliases_resolved.end())
 		return;
 
-	parameters = data.substr(delimiter);
+	data.replace(0, delimiter, it->second);
+}
+
+// Scripts are parsed once into a list of lines, each consisting of literal text and
+// $0-$9/$r/$R substitution slots, and kept in a cache keyed by path, so running them
+// (and especially repeating them) does not need to access the filesystem again.
+// An entry is reused as long as the file's mtime and size are unchanged; the cache is
+// also flushed by every fs command that changes files, as littlefs may not keep mtimes.
+
+void Command::script_compile(const std::string &line, script_line_t &script_line)
+{
+	std::string::const_iterator it;
+	script_segment_t segment;
+
+	script_line.clear();
+	segment.type = script_segment_text;
+	segment.parameter_index = 0;
+
+	auto flush = [&script_line, &segment]()
+	{
+		if(!segment.text.empty())
+		{
+			script_line.push_back(segment);
+			segment.text.clear();
+		}
+	};
+
+	auto slot = [&script_line, &flush](script_segment_type_t type, unsigned int parameter_index)
+	{
+		flush();
+		script_line.push_back({ type, parameter_index, {}});
+	};
+
+	for(it = line.begin(); it != line.end(); it++)
+	{
+		if(*it != '$')
+		{
+			segment.text.append(1, *it);
+			continue;
+		}
+
+		if((it + 1) == line.end())
+		{
+			segment.text.append(1, '!');
+			continue;
+		}
+
+		if((it[1] >= '0') && (it[1] <= '9'))
+		{
+			slot(script_segment_parameter, static_cast<unsigned int>(it[1] - '0'));
+			it++;
+			continue;
+		}
+
+		if(it[1] == 'r')
+		{
+			slot(script_segment_repeat_current, 0);
+			it++;
+			continue;
+		}
+
+		if(it[1] == 'R')
+		{
+			slot(script_segment_repeat_target, 0);
+			it++;
+			continue;
+		}
+
+		segment.text.append(1, *it);
+	}
+
+	flush();
+}
+
+void Command::script_expand(const script_line_t &script_line, const script_state_t &state, std::string &out)
+{
+	out.clear();
+
+	for(const auto &segment : script_line)
+	{
+		switch(segment.type)
+		{
+			case(script_segment_text):
+			{
+				out.append(segment.text);
+				break;
+			}
+
+			case(script_segment_parameter):
+			{
+				if(segment.parameter_index < state.parameter.size())
+					out.append(state.parameter.at(segment.parameter_index));
+				else
+					out.append(std::format("!{:d}", segment.parameter_index));
+
+				break;
+			}
+
+			case(script_segment_repeat_current):
+			{
+				out.append(std::format("{:d}", state.repeat.current));
+				break;
+			}
+
+			case(script_segment_repeat_target):
+			{
+				out.append(std::format("{:d}", state.repeat.target));
+				break;
+			}
+		}
+	}
+}
+
+std::shared_ptr<const Command::script_program_t> Command::script_load(const std::string &name)
+{
+	std::string path, line;
+	struct stat st;
+	std::ifstream file;
+	std::shared_ptr<script_program_t> program;
+	decltype(this->script_cache)::iterator it;
+
+	path = std::format("/ramdisk/{}", name);
+
+	if(::stat(path.c_str(), &st))
+	{
+		path = std::format("/littlefs/{}", name);
+
+		if(::stat(path.c_str(), &st))
+			return(nullptr);
+	}
+
+	this->script_cache_mutex.lock();
+
+	if(((it = this->script_cache.find(path)) != this->script_cache.end()) &&
+			(it->second->size == st.st_size) &&
+			(it->second->mtime.tv_sec == st.st_mtim.tv_sec) && (it->second->mtime.tv_nsec == st.st_mtim.tv_nsec))
+	{
+		this->script_cache_hits++;
+		this->script_cache_mutex.unlock();
+		return(it->second);
+	}
+
+	this->script_cache_misses++;
+	this->script_cache_mutex.unlock();
+
+	file.open(path);
+
+	if(file.fail())
+		return(nullptr);
+
+	program = std::make_shared<script_program_t>();
+	program->path = path;
+	program->mtime = st.st_mtim;
+	program->size = st.st_size;
+
+	while(std::getline(file, line))
+	{
+		while(!line.empty() && (line.back() == '\n'))
+			line.pop_back();
+
+		program->lines.emplace_back();
+		script_compile(line, program->lines.back());
+	}
+
+	this->script_cache_mutex.lock();
+
+	if((this->script_cache.size() >= script_cache_size) && !this->script_cache.contains(path))
+	{
+		for(it = this->script_cache.begin(); it != this->script_cache.end(); it++)
+		{
+			if(it->second.use_count() == 1)
+			{
+				this->script_cache.erase(it);
+				break;
+			}
+		}
+	}
+
+	if((this->script_cache.size() < script_cache_size) || this->script_cache.contains(path))
+		this->script_cache[path] = program;
+
+	this->script_cache_mutex.unlock();
+
+	return(program);
+}
+
+// Drop the cached program of a file that has been changed, or of all files below a directory (e.g. a
+// mountpoint that has been formatted). Scripts still running keep their own reference to the program.
+
+void Command::script_cache_evict(const std::string &path)
+{
+	decltype(this->script_cache)::iterator it;
+	std::scoped_lock<std::mutex> lock(this->script_cache_mutex);
 
-	data = it->second + parameters;
+	for(it = this->script_cache.begin(); it != this->script_cache.end();)
+	{
+		if((it->first == path) || (it->first.starts_with(path) && (path.ends_with('/') || (it->first[path.size()] == '/'))))
+			it = this->script_cache.erase(it);
+		else
+			it++;
+	}
 }
 
+// Script commands are submitted without waiting for their reply, up to "window" (default 1) at a time.
+// Every reply gives the script task one notification count, so ulTaskNotifyTake(pdFALSE, ...) consumes
+// exactly one reply. Replies arrive in submission order, because the receive queue never runs two commands
+// from the same source concurrently. "wait" waits for all outstanding replies, as do "pause" and the end of the script.
+
 void Command::script_thread_runner(script_state_t *thread_state)
 {
 	int task_id = 0;
+	unsigned int window = 1;
+	unsigned int in_flight = 0;
+	std::int64_t time_nominal = 0;
+
+	auto drain = [&in_flight](unsigned int limit)
+	{
+		for(; in_flight > limit; in_flight--)
+			ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+	};
+
+	// pause and repeat sleep until the previous wake up time plus their delay instead of for their delay,
+	// so the time the commands in between take doesn't add up over the iterations;
+	// start over from now when more than one delay behind
+
+	auto sleep_nominal = [&time_nominal](int msec)
+	{
+		std::int64_t now = esp_timer_get_time();
+
+		time_nominal += msec * 1000LL;
+
+		if(time_nominal < (now - (msec * 1000LL)))
+			time_nominal = now + (msec * 1000LL);
+
+		if(time_nominal > now)
+			std::this_thread::sleep_for(std::chrono::microseconds(time_nominal - now));
+	};
 
 	try
 	{
 		std::deque<script_state_t *> script_thread_states;
-		std::string initial_script, line, command, expanded_line;
-		unsigned int parameter_index;
+		std::string initial_script, command, expanded_line;
 		size_t pos, start, end;
 		TaskStatus_t status;
 		script_thread_t script_thread;
@@ -2145,6 +4094,7 @@ void Command::script_thread_runner(script_state_t *thread_state)
 
 		script_thread.stop = false;
 		script_thread.stopping = false;
+		script_thread.window = window;
 
 		this->script_thread_mutex.lock();
 		this->script_thread_map[task_id] = script_thread;
@@ -2158,8 +4108,10 @@ void Command::script_thread_runner(script_state_t *thread_state)
 			thread_state = script_thread_states.front();
 			script_thread_states.pop_front();
 
-			while(std::getline(thread_state->file, line))
+			while(thread_state->line < thread_state->program->lines.size())
 			{
+				const script_line_t &script_line = thread_state->program->lines[thread_state->line++];
+
 				stop = false;
 
 				this->script_thread_mutex.lock();
@@ -2178,59 +4130,7 @@ void Command::script_thread_runner(script_state_t *thread_state)
 					break;
 				}
 
-				while(!line.empty() && (line.back() == '\n'))
-					line.pop_back();
-
-				expanded_line.clear();
-
-				for(std::string::const_iterator it = line.begin(); it != line.end(); it++) // FIXME: make dedicated parser
-				{
-					if(*it != '$')
-					{
-						expanded_line.append(1, *it);
-						continue;
-					}
-
-					if((it + 1) == line.end())
-					{
-						expanded_line.append(1, '!');
-						continue;
-					}
-
-					if((it[1] >= '0') && (it[1] <= '9'))
-					{
-						parameter_index = static_cast<int>(it[1] - '0');
-
-						if(parameter_index < thread_state->parameter.size())
-							expanded_line.append(thread_state->parameter.at(parameter_index));
-						else
-							expanded_line.append(std::format("!{:d}", parameter_index));
-
-						it++;
-
-						continue;
-					}
-
-					if(it[1] == 'r')
-					{
-						expanded_line.append(std::format("{:d}", thread_state->repeat.current));
-
-						it++;
-
-						continue;
-					}
-
-					if(it[1] == 'R')
-					{
-						expanded_line.append(std::format("{:d}", thread_state->repeat.target));
-
-						it++;
-
-						continue;
-					}
-
-					expanded_line.append(1, *it);
-				}
+				script_expand(script_line, *thread_state, expanded_line);
 
 				if((pos = expanded_line.find(' ')) == std::string::npos)
 					command = expanded_line;
@@ -2285,16 +4185,46 @@ void Command::script_thread_runner(script_state_t *thread_state)
 						}
 					}
 
-					thread_state->file.open(std::format("/ramdisk/{}", thread_state->script));
+					thread_state->line = 0;
 
-					if(thread_state->file.fail())
-					{
-						thread_state->file.open(std::format("/littlefs/{}", thread_state->script));
+					if(!(thread_state->program = this->script_load(thread_state->script)))
+						throw(transient_exception(std::format("script: script {} in call statement from top level script {} not found", thread_state->script, initial_script)));
+
+					continue;
+				}
+
+				if(command == "wait")
+				{
+					drain(0);
+					continue;
+				}
 
-						if(thread_state->file.fail())
-							throw(transient_exception(std::format("script: script {} in call statement from top level script {} not found", thread_state->script, initial_script)));
+				if(command == "window")
+				{
+					int value = 0;
+
+					if(pos != std::string::npos)
+					{
+						try
+						{
+							value = std::stoi(expanded_line.substr(pos));
+						}
+						catch(...)
+						{
+							value = 0;
+						}
 					}
 
+					if((value < 1) || (value > static_cast<int>(script_window_max)))
+						throw(transient_exception(std::format("script: invalid window size: {:d}, should be 1 - {:d}", value, script_window_max)));
+
+					window = static_cast<unsigned int>(value);
+					drain(window);
+
+					this->script_thread_mutex.lock();
+					this->script_thread_map[task_id].window = window;
+					this->script_thread_mutex.unlock();
+
 					continue;
 				}
 
@@ -2302,6 +4232,8 @@ void Command::script_thread_runner(script_state_t *thread_state)
 				{
 					int sleep_msec;
 
+					drain(0);
+
 					if(pos == std::string::npos)
 						sleep_msec = 1000;
 					else
@@ -2317,7 +4249,7 @@ void Command::script_thread_runner(script_state_t *thread_state)
 					}
 
 					if((sleep_msec > 0) && (sleep_msec >= 10))
-						std::this_thread::sleep_for(std::chrono::milliseconds(sleep_msec));
+						sleep_nominal(sleep_msec);
 
 					continue;
 				}
@@ -2334,8 +4266,8 @@ void Command::script_thread_runner(script_state_t *thread_state)
 						}
 						else
 						{
-							thread_state->file.seekg(0);
-							std::this_thread::sleep_for(std::chrono::milliseconds(100));
+							thread_state->line = 0;
+							sleep_nominal(100);
 						}
 					}
 					else
@@ -2360,14 +4292,14 @@ void Command::script_thread_runner(script_state_t *thread_state)
 						thread_state->repeat.target = target;
 						thread_state->repeat.current = 1;
 						thread_state->repeat.active = true;
-						thread_state->file.seekg(0);
-						std::this_thread::sleep_for(std::chrono::milliseconds(100));
+						thread_state->line = 0;
+						sleep_nominal(100);
 					}
 
 					continue;
 				}
 
-				command_response_t *command_response = new command_response_t;
+				command_response_t *command_response = this->response_pool_get();
 
 				command_response->source = cli_source_script;
 				command_response->mtu = 120;
@@ -2376,9 +4308,10 @@ void Command::script_thread_runner(script_state_t *thread_state)
 				command_response->script.name = thread_state->script;
 				command_response->script.task = xTaskGetCurrentTaskHandle();
 
-				this->receive_queue_push(command_response);
+				drain(window - 1);
 
-				ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+				this->receive_queue_push(command_response);
+				in_flight++;
 
 				command_response = nullptr;
 			}
@@ -2403,6 +4336,8 @@ void Command::script_thread_runner(script_state_t *thread_state)
 		this->log << "script: unknown exception";
 	}
 
+	drain(0);
+
 	std::map<int, script_thread_t>::iterator it;
 
 	this->script_thread_mutex.lock();
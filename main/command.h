@@ -18,12 +18,21 @@
 #include "sensor.h"
 #include "exception.h"
 #include "cli-command.h"
+#include "command-index.h"
 #include "display.h"
 
 #include <string>
+#include <string_view>
+#include <array>
 #include <deque>
 #include <fstream>
 #include <mutex>
+#include <condition_variable>
+#include <set>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <unordered_map>
 
 class Command final
 {
@@ -102,6 +111,13 @@ class Command final
 		static void cat(cli_command_call_t *);
 		static void script_info(cli_command_call_t *);
 		static void script_stop(cli_command_call_t *);
+		static void job_start(cli_command_call_t *);
+		static void job_info(cli_command_call_t *);
+		static void job_result(cli_command_call_t *);
+		static void job_cancel(cli_command_call_t *);
+		static void schedule_every(cli_command_call_t *);
+		static void schedule_cron(cli_command_call_t *);
+		static void schedule_remove(cli_command_call_t *);
 		static void i2c_speed(cli_command_call_t *);
 		static void i2c_probe(cli_command_call_t *);
 
@@ -112,19 +128,71 @@ class Command final
 		static Command &get();
 
 		void run();
-		void receive_queue_push(command_response_t *);
+		command_response_t *response_pool_get();
+		void receive_queue_push(command_response_t *, bool block = true);
 
 	private:
 
 		static constexpr int receive_queue_size = 8;
+		static constexpr int workers_default = 2;
+		static constexpr int workers_max = 4;
 		static constexpr int send_queue_size = 8;
+		static constexpr unsigned int batch_size_max = 16;
+		static constexpr std::string_view batch_marker = "!batch\n";
+		static constexpr unsigned int busy_retry_ms = 50;
+		static constexpr unsigned int busy_sources_max = 8;
+		static constexpr unsigned int request_id_length_max = 16;
+		static constexpr char request_chunked_marker = '+';
+		static constexpr std::string_view truncated_marker = "\n[truncated]";
+		static constexpr int latency_buckets = 24;
+		static constexpr int response_pool_size = (receive_queue_size * 2) + send_queue_size + 8;
+		static constexpr int response_pool_retain_size = 4096;
+		static constexpr unsigned int script_cache_size = 16;
+		static constexpr unsigned int script_window_max = receive_queue_size;
+		static constexpr unsigned int schedule_jobs_max = 16;
+		static constexpr unsigned int schedule_scripts_max = 4;
+		static constexpr unsigned int alias_depth_max = 8;
+		static constexpr unsigned int jobs_max = 8;
+		static constexpr unsigned int jobs_running_max = 2;
+		static constexpr unsigned int job_mtu = 16384;
+		static constexpr unsigned int result_cache_size = 16;
+		static constexpr int result_cache_ttl_default_ms = 1000;
+		static constexpr unsigned int alias_config_size_max = 4000;
+		static constexpr std::int64_t schedule_idle_usec = 1000000;
+		static constexpr time_t schedule_clock_valid = 1700000000;
 
 		typedef std::deque<std::string> string_deque_t;
 
+		enum script_segment_type_t
+		{
+			script_segment_text,
+			script_segment_parameter,
+			script_segment_repeat_current,
+			script_segment_repeat_target,
+		};
+
+		struct script_segment_t
+		{
+			script_segment_type_t type;
+			unsigned int parameter_index;
+			std::string text;
+		};
+
+		typedef std::vector<script_segment_t> script_line_t;
+
+		struct script_program_t
+		{
+			std::string path;
+			struct timespec mtime;
+			off_t size;
+			std::vector<script_line_t> lines;
+		};
+
 		struct script_state_t
 		{
 			std::string script;
-			std::ifstream file;
+			std::shared_ptr<const script_program_t> program;
+			unsigned int line;
 			struct
 			{
 				bool active;
@@ -139,84 +207,147 @@ class Command final
 			std::string command_line;
 			bool stop;
 			bool stopping;
+			unsigned int window;
 		};
 
-		typedef void(cli_command_function_t)(cli_command_call_t *);
+		struct cli_command_flags_t
+		{
+			unsigned int serialise:1 = 0;
+			unsigned int bulk:1 = 0;
+			unsigned int idempotent:1 = 0;
+		};
 
-		struct cli_unsigned_int_description_t
+		enum receive_lane_t
 		{
-			unsigned int lower_bound;
-			unsigned int upper_bound;
+			receive_lane_interactive = 0,
+			receive_lane_bulk,
+			receive_lane_size,
 		};
 
-		struct cli_signed_int_description_t
+		struct receive_lane_stats_t
 		{
-			int lower_bound;
-			int upper_bound;
+			unsigned int queued_max;
+			unsigned int dispatched;
+			unsigned int deferred;
+			unsigned int push_waits;
 		};
 
-		struct cli_float_description_t
+		struct busy_source_t
+		{
+			cli_source_t source;
+			unsigned int replies;
+			unsigned int dropped;
+			std::int64_t time_last;
+		};
+
+		struct cli_command_t
 		{
-			float lower_bound;
-			float upper_bound;
+			const char *name;
+			const char *alias;
+			const char *help;
+			cli_command_function_t *function;
+			cli_parameters_description_t parameters_description;
+			cli_command_flags_t flags = {};
 		};
 
-		struct cli_string_description_t
+		struct latency_stats_t
 		{
-			unsigned int lower_length_bound;
-			unsigned int upper_length_bound;
+			unsigned int count;
+			unsigned int min;
+			unsigned int max;
+			std::uint64_t total;
+			unsigned int histogram[latency_buckets];
 		};
 
-		struct cli_parameter_description_t
+		struct cli_command_stats_t
 		{
-			cli_parameter_type_description_t type:4;
+			unsigned int calls;
+			unsigned int errors;
+			latency_stats_t queue;
+			latency_stats_t execute;
+			latency_stats_t send;
+		};
 
-			unsigned int base:5;
-			unsigned int value_required:1;
-			unsigned int lower_bound_required:1;
-			unsigned int upper_bound_required:1;
+		struct schedule_cron_field_t
+		{
+			int value;
+			int step;
+		};
 
-			const char *description;
+		struct schedule_job_t
+		{
+			std::string command;
+			unsigned int interval_ms;
+			schedule_cron_field_t minute;
+			schedule_cron_field_t hour;
+			std::int64_t deadline;
+			time_t wall_due;
+			bool armed;
+			unsigned int fired;
+			unsigned int missed;
+			latency_stats_t lateness;
+		};
 
-			union
-			{
-				cli_unsigned_int_description_t	unsigned_int;
-				cli_signed_int_description_t	signed_int;
-				cli_float_description_t			fp;
-				cli_string_description_t		string;
-			};
+		struct result_cache_entry_t
+		{
+			bool in_flight;
+			bool valid;
+			std::int64_t time_stored;
+			std::string result;
+			std::string result_oob;
 		};
 
-		struct cli_parameters_description_t
+		enum job_state_t
 		{
-			unsigned int count;
-			cli_parameter_description_t entries[parameters_size];
+			job_running,
+			job_done,
+			job_failed,
+			job_cancelled,
 		};
 
-		struct cli_command_t
+		struct job_t
 		{
-			const char *name;
-			const char *alias;
-			const char *help;
-			cli_command_function_t *function;
-			cli_parameters_description_t parameters_description;
+			std::string command_line;
+			job_state_t state;
+			bool cancel;
+			unsigned int progress;
+			std::int64_t time_start;
+			std::int64_t time_finish;
+			std::string result;
+			std::string result_oob;
 		};
 
 		static const std::map<cli_parameter_type_description_t, std::string> parameter_type_to_string;
+		static const std::map<job_state_t, std::string> job_state_to_string;
 		static const cli_command_t cli_commands[];
 
 		//FIXME
-		static int cli_stats_commands_received;
-		static int cli_stats_commands_received_packet;
-		static int cli_stats_commands_received_raw;
-		static int cli_stats_replies_sent;
-		static int cli_stats_replies_sent_packet;
-		static int cli_stats_replies_sent_raw;
+		static std::atomic<int> cli_stats_commands_received;
+		static std::atomic<int> cli_stats_commands_received_packet;
+		static std::atomic<int> cli_stats_commands_received_raw;
+		static std::atomic<int> cli_stats_commands_received_batch;
+		static std::atomic<int> cli_stats_commands_received_binary;
+		static std::atomic<int> cli_stats_commands_received_request_id;
+		static std::atomic<int> cli_stats_replies_sent;
+		static std::atomic<int> cli_stats_replies_sent_packet;
+		static std::atomic<int> cli_stats_replies_sent_raw;
+		static std::atomic<int> cli_stats_replies_chunked;
+		static std::atomic<int> cli_stats_replies_truncated;
 
 		static Command *singleton;
 
+		struct string_hash_t
+		{
+			using is_transparent = void;
+			std::size_t operator()(std::string_view key) const { return(std::hash<std::string_view>{}(key)); }
+		};
+
 		typedef std::map<std::string, std::string> string_string_map;
+		typedef std::unordered_map<std::string, std::string, string_hash_t, std::equal_to<>> alias_index_t;
 		string_string_map aliases;
+		alias_index_t aliases_resolved;
+		std::atomic<bool> aliases_active;
+		std::mutex aliases_mutex;
 
 		Config &config;
 		Console &console;
@@ -237,21 +368,106 @@ class Command final
 		Sensors &sensors;
 		Display& display;
 
-		QueueHandle_t receive_queue_handle;
+		std::array<std::deque<command_response_t *>, receive_lane_size> receive_queue;
+		std::array<receive_lane_stats_t, receive_lane_size> receive_lane_stats;
+		unsigned int receive_queue_sequence;
+		unsigned int receive_queue_bulk_active;
+		std::map<unsigned int, busy_source_t> receive_queue_busy; // per source_key, the busy_sources_max most recent
+		unsigned int receive_queue_busy_queued;
+		unsigned int receive_queue_busy_dropped;
+		std::set<unsigned int> receive_queue_active_sources;
+		std::mutex receive_queue_mutex;
+		std::condition_variable receive_queue_condition;
 		QueueHandle_t send_queue_handle;
+		std::mutex serialise_mutex;
+		int workers;
+		bool chunked_replies;
+
+		cli_command_stats_t *command_stats;
+		unsigned int command_stats_size;
+		std::mutex command_stats_mutex;
 		bool running;
 
+		command_response_t *response_pool;
+		std::array<command_response_t *, response_pool_size> response_pool_free;
+		int response_pool_free_count;
+		std::mutex response_pool_mutex;
+		int response_pool_stats_in_use_max;
+		int response_pool_stats_exhausted;
+
 		std::string make_exception_text(std::string_view fn, std::string_view message1, std::string_view message2);
 		void help(std::string &out);
 		void help(std::string &out, std::string_view filter);
+		static const cli_command_t *find_command(std::string_view name);
+		void response_pool_put(command_response_t *);
+		static unsigned int source_key(const command_response_t *);
+		static const char *source_name(cli_source_t);
+		bool receive_queue_bulk(const std::string &data);
+		bool receive_queue_eligible(unsigned int lane, const command_response_t *);
+		bool receive_queue_pending(unsigned int key);
+		void receive_queue_busy_count(const command_response_t *);
 		command_response_t *receive_queue_pop();
-		void send_queue_push(command_response_t *);
+		void receive_queue_release(unsigned int key, bool bulk);
+		command_response_t *response_pool_clone(const command_response_t *);
+		bool send_queue_push(command_response_t *, bool block = true);
+		void send_queue_push_chunked(command_response_t *, const std::string &result, const std::string &prefix);
+		static void request_id_strip(command_response_t *);
+		static std::string request_id_prefix(const command_response_t *);
 		command_response_t *send_queue_pop();
+		command_response_t *send_queue_peek();
+		void send_done(command_response_t *);
+		static void latency_record(latency_stats_t &, std::int64_t usec);
+		static unsigned int latency_percentile(const latency_stats_t &, unsigned int percentile);
+		static void latency_format(std::string &out, std::string_view name, const latency_stats_t &, bool histogram);
+		void command_stats_record(int command_index, latency_stats_t cli_command_stats_t::*which, std::int64_t usec);
+		void command_stats_failed(int command_index, std::int64_t time_execute);
+		int execute(const command_response_t *, std::string &data, cli_command_call_t &, bool *failed = nullptr);
+		void split_batch(const std::string &data, string_deque_t &lines);
 		[[noreturn]] void run_receive_queue();
 		[[noreturn]] void run_send_queue();
 		void alias_command(cli_command_call_t *);
-		void alias_expand(std::string &) const;
+		void alias_expand(std::string &);
+		void alias_resolve(const string_string_map &, alias_index_t &);
+		void alias_load();
+		void alias_save(const string_string_map &);
 		std::mutex script_thread_mutex;
 		void script_thread_runner(script_state_t *);
 		std::map<int, script_thread_t> script_thread_map;
+		std::map<std::string, std::shared_ptr<const script_program_t>> script_cache;
+		std::mutex script_cache_mutex;
+		unsigned int script_cache_hits;
+		unsigned int script_cache_misses;
+		static void script_compile(const std::string &line, script_line_t &);
+		static void script_expand(const script_line_t &, const script_state_t &, std::string &out);
+		std::shared_ptr<const script_program_t> script_load(const std::string &name);
+		static script_state_t *script_state_new(const std::string &script, std::shared_ptr<const script_program_t> program);
+		void script_cache_evict(const std::string &path);
+		std::map<std::string, schedule_job_t> schedule_jobs;
+		std::mutex schedule_mutex;
+		TaskHandle_t schedule_task;
+		std::deque<std::pair<std::string, std::string>> schedule_scripts;
+		std::condition_variable schedule_scripts_condition;
+		unsigned int schedule_scripts_run;
+		unsigned int schedule_scripts_dropped;
+		static bool schedule_cron_parse(std::string_view spec, int max, schedule_cron_field_t &);
+		static std::string schedule_cron_string(const schedule_cron_field_t &);
+		static bool schedule_cron_match(const schedule_cron_field_t &, int value);
+		static void schedule_arm(schedule_job_t &, std::int64_t now);
+		void schedule_add(const std::string &name, schedule_job_t &job);
+		bool schedule_script(const std::string &name, const std::string &command_line);
+		[[noreturn]] void run_scheduler();
+		[[noreturn]] void run_schedule_scripts();
+		std::map<unsigned int, job_t> jobs;
+		std::mutex jobs_mutex;
+		unsigned int job_next_id;
+		void job_runner(unsigned int id);
+		std::map<std::string, result_cache_entry_t> result_cache;
+		std::mutex result_cache_mutex;
+		std::condition_variable result_cache_condition;
+		int result_cache_ttl_ms;
+		unsigned int result_cache_hits;
+		unsigned int result_cache_coalesced;
+		unsigned int result_cache_misses;
+		bool result_cache_get(const std::string &key, cli_command_call_t &call);
+		void result_cache_put(const std::string &key, const cli_command_call_t *call);
 };
@@ -298,7 +298,7 @@ void Console::thread_runner()
 
 			if(line->length() > 0)
 			{
-				command_response_t *command_response = new command_response_t;
+				command_response_t *command_response = this->command->response_pool_get();
 
 				command_response->source = cli_source_console;
 				command_response->mtu = 32768;
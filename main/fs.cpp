@@ -193,25 +193,50 @@ void FS::truncate(const std::string &file, int position)
 		throw(transient_exception(this->log.errno_string_error(errno, std::format("FS::truncate: truncate of {} failed", file))));
 }
 
-std::string FS::checksum(const std::string &file)
+std::string FS::checksum(const std::string &file, const std::function<void(unsigned int)> &progress)
 {
 	int length, fd;
 	Crypt::SHA256 md;
 	std::string hash_text;
 	std::string block;
+	struct stat st;
+	off_t done;
+	unsigned int percent, last_percent;
 
 	if((fd = open(file.c_str(), O_RDONLY, 0)) < 0)
 		throw(transient_exception(this->log.errno_string_error(errno, std::format("FS::checksum: open {} failed", file))));
 
+	if(fstat(fd, &st))
+		st.st_size = 0;
+
 	md.init();
 
 	block.resize(4096);
+	done = 0;
+	last_percent = 0;
 
 	while((length = ::read(fd, block.data(), block.size())) > 0)
 	{
 		block.resize(length);
 		md.update(block);
 		block.resize(4096);
+
+		done += length;
+
+		if(progress && (st.st_size > 0) && ((percent = (done * 100) / st.st_size) != last_percent))
+		{
+			try
+			{
+				progress(percent);
+			}
+			catch(...)
+			{
+				close(fd);
+				throw;
+			}
+
+			last_percent = percent;
+		}
 	}
 
 	close(fd);
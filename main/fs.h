@@ -4,6 +4,7 @@
 #include "ramdisk.h"
 
 #include <string>
+#include <functional>
 
 class FS final
 {
@@ -22,7 +23,7 @@ class FS final
 		void erase(const std::string &file);
 		void rename(const std::string &from, const std::string &to);
 		void truncate(const std::string &file, int position);
-		std::string checksum(const std::string &file);
+		std::string checksum(const std::string &file, const std::function<void(unsigned int)> &progress = nullptr);
 		void info(std::string &out);
 
 	private:
@@ -53,8 +53,8 @@ void app_main()
 		FS fs(log, ramdisk);
 		BT bt(log, config);
 		WLAN wlan(log, config, notify, system);
-		UDP udp(log);
-		TCP tcp(log);
+		UDP udp(log, config);
+		TCP tcp(log, config);
 		I2c i2c(log, config);
 		Sensors sensors(log, i2c);
 		SPI spi(log, config);
@@ -5,11 +5,13 @@
 #include "util.h"
 #include "crypt.h"
 #include "cli-command.h"
+#include "exception.h"
 
 #include <esp_ota_ops.h>
 #include <esp_image_format.h>
 
 #include <string>
+#include <algorithm>
 #include <boost/format.hpp>
 #include <format>
 
@@ -17,9 +19,13 @@ static bool ota_handle_active = false;
 static const esp_partition_t *ota_partition = (const esp_partition_t *)0;
 static esp_ota_handle_t ota_handle;
 
+static constexpr unsigned int ota_block_size = 4096;
+
 static Crypt::SHA256 md;
 static bool md_active = false;
 static unsigned int ota_length = 0;
+static unsigned int ota_written = 0;
+static unsigned int ota_hashed = 0;
 
 static int partition_to_slot(const esp_partition_t *partition)
 {
@@ -50,6 +56,8 @@ static void ota_abort(void)
 	}
 
 	ota_length = 0;
+	ota_written = 0;
+	ota_hashed = 0;
 }
 
 void command_ota_start(cli_command_call_t *call)
@@ -63,22 +71,13 @@ void command_ota_start(cli_command_call_t *call)
 	length = call->parameters[0].unsigned_int;
 
 	if(!(partition = esp_ota_get_next_update_partition((const esp_partition_t *)0)))
-	{
-		call->result = "ERROR: no valid OTA partition";
-		return;
-	}
+		throw(hard_exception("no valid OTA partition"));
 
 	if(partition->type != ESP_PARTITION_TYPE_APP)
-	{
-		call->result = (boost::format("ERROR: partition %s is not APP") % partition->label).str();
-		return;
-	}
+		throw(hard_exception((boost::format("partition %s is not APP") % partition->label).str()));
 
 	if(length > partition->size)
-	{
-		call->result = (boost::format("ERROR: ota partition too small for image: %u vs. %lu") % length % partition->size).str();
-		return;
-	}
+		throw(hard_exception((boost::format("ota partition too small for image: %u vs. %lu") % length % partition->size).str()));
 
 	if(ota_handle_active || md_active)
 	{
@@ -88,13 +87,15 @@ void command_ota_start(cli_command_call_t *call)
 
 	if((rv = esp_ota_begin(partition, length, &ota_handle)))
 	{
-		call->result = (boost::format("ERROR: esp_ota_begin: %s (0x%x)") % esp_err_to_name(rv) % rv).str();
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception((boost::format("esp_ota_begin: %s (0x%x)") % esp_err_to_name(rv) % rv).str()));
 	}
 
 	ota_partition = partition;
 	ota_handle_active = true;
 	ota_length = length;
+	ota_written = 0;
+	ota_hashed = 0;
 
 	md.init();
 	md_active = true;
@@ -114,36 +115,46 @@ void command_ota_write(cli_command_call_t *call)
 
 	if(!md_active)
 	{
-		call->result = "ERROR: hash context not active";
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception("hash context not active"));
 	}
 
 	if(!ota_handle_active)
 	{
-		call->result = "ERROR: ota write context not active";
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception("ota write context not active"));
 	}
 
 	if(call->oob.length() != length)
 	{
-		call->result = (boost::format("ERROR: lengths do not match (%u vs. %u)") % length % call->oob.length()).str();
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception((boost::format("lengths do not match (%u vs. %u)") % length % call->oob.length()).str()));
 	}
 
 	if(checksum_chunk && (length != 32))
 	{
-		call->result = (boost::format("ERROR: invalid checksum chunk length (%u vs. %u)") % length % 32).str();
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception((boost::format("invalid checksum chunk length (%u vs. %u)") % length % 32).str()));
 	}
 
 	if((rv = esp_ota_write(ota_handle, call->oob.data(), call->oob.length())))
 	{
-		call->result = (boost::format("ERROR: esp_ota_write returned error %d") % rv).str();
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception((boost::format("esp_ota_write returned error %d") % rv).str()));
 	}
 
+	ota_written += length;
+
 	if(!checksum_chunk)
+	{
 		md.update(call->oob);
+		ota_hashed += length;
+	}
+
+	// progress is over the whole image, as announced by ota-start
+
+	if(call->progress && (ota_length > 0))
+		call->progress(std::min(100U, static_cast<unsigned int>((ota_written * 100ULL) / ota_length)));
 
 	call->result = "OK write ota";
 }
@@ -156,14 +167,14 @@ void command_ota_finish(cli_command_call_t *call)
 
 	if(!md_active)
 	{
-		call->result = "ERROR: hash context not active";
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception("hash context not active"));
 	}
 
 	if(!ota_handle_active)
 	{
-		call->result = "ERROR: ota write context not active";
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception("ota write context not active"));
 	}
 
 	hash = md.finish();
@@ -173,8 +184,8 @@ void command_ota_finish(cli_command_call_t *call)
 
 	if((rv = esp_ota_end(ota_handle)))
 	{
-		call->result = (boost::format("ERROR: esp_ota_end failed: %s (0x%x)") % esp_err_to_name(rv) % rv).str();
-		return(ota_abort());
+		ota_abort();
+		throw(hard_exception((boost::format("esp_ota_end failed: %s (0x%x)") % esp_err_to_name(rv) % rv).str()));
 	}
 
 	ota_handle_active = false;
@@ -197,49 +208,71 @@ void command_ota_commit(cli_command_call_t *call)
 	remote_hash_text = call->parameters[0].str;
 
 	if(!ota_partition)
+		throw(hard_exception("commit: no active OTA partition"));
+
+	if(call->progress)
+		call->progress(0);
+
+	// hash what has been written in this session (without the appended checksum) block by block, so progress can be reported;
+	// esp_partition_get_sha256 yields the same hash but in one call
+
+	if(ota_hashed > 0)
 	{
-		call->result = "ERROR: commit: no active OTA partition";
-		return;
-	}
+		Crypt::SHA256 partition_md;
+		std::string block;
+		unsigned int offset, length, percent, last_percent;
+
+		partition_md.init();
+		last_percent = 0;
+
+		for(offset = 0; offset < ota_hashed; offset += length)
+		{
+			length = std::min(ota_block_size, ota_hashed - offset);
+			block.resize(length);
+
+			if((rv = esp_partition_read(ota_partition, offset, block.data(), length)))
+				throw(hard_exception((boost::format("esp_partition_read failed: %u") % rv).str()));
 
-	local_hash.resize(32);
+			partition_md.update(block);
 
-	if((rv = esp_partition_get_sha256(ota_partition, reinterpret_cast<uint8_t *>(local_hash.data()))))
+			if(call->progress && ((percent = ((offset + length) * 90ULL) / ota_hashed) != last_percent))
+			{
+				call->progress(percent);
+				last_percent = percent;
+			}
+		}
+
+		local_hash = partition_md.finish();
+	}
+	else
 	{
-		call->result = (boost::format("ERROR: esp_partition_get_sha256 failed: %u") % rv).str();
-		return;
+		local_hash.resize(32);
+
+		if((rv = esp_partition_get_sha256(ota_partition, reinterpret_cast<uint8_t *>(local_hash.data()))))
+			throw(hard_exception((boost::format("esp_partition_get_sha256 failed: %u") % rv).str()));
+
+		if(call->progress)
+			call->progress(90);
 	}
 
 	local_hash_text = Crypt::hash_to_text(local_hash);
 
 	if(remote_hash_text != local_hash_text)
-	{
-		call->result = (boost::format("ERROR: checksum mismatch: %s vs. %s") % remote_hash_text % local_hash_text).str();
-		return;
-	}
+		throw(hard_exception((boost::format("checksum mismatch: %s vs. %s") % remote_hash_text % local_hash_text).str()));
 
 	if((rv = esp_ota_set_boot_partition(ota_partition)))
-	{
-		call->result = (boost::format("ERROR: esp_ota_set_boot_partition failed: %u") % rv).str();
-		return;
-	}
+		throw(hard_exception((boost::format("esp_ota_set_boot_partition failed: %u") % rv).str()));
 
 	ota_partition = (const esp_partition_t *)0;
 
 	if(!(boot_partition = esp_ota_get_boot_partition()))
-	{
-		call->result = "ERROR: esp_ota_get_boot_partition";
-		return;
-	}
+		throw(hard_exception("esp_ota_get_boot_partition"));
 
 	partition_pos.offset = boot_partition->address;
 	partition_pos.size = boot_partition->size;
 
 	if((rv = esp_image_verify(ESP_IMAGE_VERIFY, &partition_pos, &image_metadata)))
-	{
-		call->result = (boost::format("ERROR: esp_image_verify failed: %u") % rv).str();
-		return;
-	}
+		throw(hard_exception((boost::format("esp_image_verify failed: %u") % rv).str()));
 
 	call->result = "OK commit ota";
 }
@@ -251,10 +284,7 @@ void command_ota_confirm(cli_command_call_t *call)
 	assert(call->parameter_count == 0);
 
 	if((rv = esp_ota_mark_app_valid_cancel_rollback()))
-	{
-		call->result = (boost::format("ERROR: esp_ota_mark_app_valid_cancel_rollback failed: %u") % rv).str();
-		return;
-	}
+		throw(hard_exception((boost::format("esp_ota_mark_app_valid_cancel_rollback failed: %u") % rv).str()));
 
 	call->result = "OK confirm ota";
 }
@@ -8,20 +8,36 @@
 #include <string.h> // for memcpy
 #include <sys/socket.h>
 #include <sys/poll.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
 
 #include <esp_pthread.h>
+#include <esp_timer.h>
 
 #include <thread>
 #include <chrono>
+#include <algorithm>
 
 TCP *TCP::singleton = nullptr;
 
-TCP::TCP(Log &log_in) : log(log_in)
+TCP::TCP(Log &log_in, Config &config_in) : log(log_in), config(config_in)
 {
 	if(this->singleton)
 		throw(hard_exception("TCP: already active"));
 
-	this->socket_fd = -1;
+	for(auto &connection : this->connections)
+	{
+		connection.fd = -1;
+		connection.senders = 0;
+		connection.closing = false;
+	}
+
+	this->mtu = mtu_default;
+	this->send_buffer_size = 0;
+	this->idle_timeout_s = idle_timeout_default_s;
+	this->keepalive_idle_s = keepalive_idle_default_s;
+	this->nodelay = true;
+	this->connection_id_next = 1;
 	this->running = false;
 	this->command = nullptr;
 	this->singleton = this;
@@ -43,17 +59,54 @@ void TCP::set(Command *in)
 	this->command = in;
 }
 
+bool TCP::config_get(const std::string &id, int &value)
+{
+	try
+	{
+		value = this->config.get_int(id);
+	}
+	catch(const transient_exception &)
+	{
+		return(false);
+	}
+
+	return(true);
+}
+
+void TCP::stats_add(const char *name, int value)
+{
+	std::scoped_lock lock(this->connections_mutex);
+
+	this->stats[name] += value;
+}
+
 void TCP::run()
 {
 	esp_err_t rv;
 	esp_pthread_cfg_t thread_config = esp_pthread_get_default_config();
+	int value;
 
 	if(this->running)
 		throw(hard_exception("TCP::run: already running"));
 
+	if(this->config_get("tcp.mtu", value))
+		this->mtu = std::clamp(value, mtu_min, mtu_max);
+
+	if(this->config_get("tcp.sndbuf", value) && (value >= 0))
+		this->send_buffer_size = value;
+
+	if(this->config_get("tcp.idle", value) && (value >= 0))
+		this->idle_timeout_s = value;
+
+	if(this->config_get("tcp.keepalive", value) && (value >= 0))
+		this->keepalive_idle_s = value;
+
+	if(this->config_get("tcp.nodelay", value))
+		this->nodelay = value != 0;
+
 	thread_config.thread_name = "tcp";
 	thread_config.pin_to_core = 1;
-	thread_config.stack_size = 2 * 1024;
+	thread_config.stack_size = 3 * 1024;
 	thread_config.prio = 1;
 	thread_config.stack_alloc_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
 
@@ -67,187 +120,365 @@ void TCP::run()
 	new_thread.detach();
 }
 
-void TCP::thread_runner()
+void TCP::connection_accept(int accept_fd)
 {
-	std::string receive_buffer;
-	int accept_fd, rv, length;
 	struct sockaddr_in6 si6_addr;
 	socklen_t si6_addr_length;
-	struct pollfd pfd;
+	int fd;
 
-	try
+	si6_addr_length = sizeof(si6_addr);
+
+	if((fd = ::accept(accept_fd, reinterpret_cast<struct sockaddr *>(&si6_addr), &si6_addr_length)) < 0)
 	{
-		if(!this->command)
-			throw(hard_exception("TCP::thread_runner: command not set"));
+		this->stats_add("connections failed");
+		return;
+	}
 
-		if((accept_fd = ::socket(AF_INET6, SOCK_STREAM, 0)) < 0)
-			throw(transient_exception(this->log.errno_string_error(errno, "TCP::thread_runner: socket")));
+	this->connection_options(fd);
 
-		memset(&si6_addr, 0, sizeof(si6_addr));
-		si6_addr.sin6_family = AF_INET6;
-		si6_addr.sin6_port = htons(24);
+	std::scoped_lock lock(this->connections_mutex);
 
-		if(::bind(accept_fd, reinterpret_cast<const struct sockaddr *>(&si6_addr), sizeof(si6_addr)) != 0)
-			throw(transient_exception(this->log.errno_string_error(errno, "TCP::thread_runner: bind")));
+	for(auto &connection : this->connections)
+	{
+		if(connection.fd >= 0)
+			continue;
+
+		connection.fd = fd;
+		connection.id = this->connection_id_next++;
+		connection.senders = 0;
+		connection.closing = false;
+		connection.address = si6_addr;
+		connection.address_length = si6_addr_length;
+		connection.receive_buffer.clear();
+		connection.receive_offset = 0;
+		connection.time_connected = esp_timer_get_time();
+		connection.time_received = 0;
+		connection.time_active = connection.time_connected;
+		connection.receive_bytes = 0;
+		connection.receive_packets = 0;
+		connection.send_bytes = 0;
+		connection.send_packets = 0;
+
+		if(this->connection_id_next == 0)
+			this->connection_id_next = 1;
+
+		this->stats["connections accepted"]++;
+		return;
+	}
 
-		if(::listen(accept_fd, 0) != 0)
-			throw(transient_exception(this->log.errno_string_error(errno, "TCP::thread_runner: listen")));
+	::close(fd);
+	this->stats["connections rejected"]++;
+}
 
-		for(;;)
+void TCP::connection_options(int fd)
+{
+	int value;
+
+	if(this->nodelay)
+	{
+		value = 1;
+
+		if(::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)))
+			this->stats_add("setsockopt nodelay failures");
+	}
+
+	if(this->send_buffer_size > 0)
+	{
+		value = this->send_buffer_size;
+
+		if(::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value)))
+			this->stats_add("setsockopt sndbuf failures");
+	}
+
+	if(this->keepalive_idle_s > 0)
+	{
+		value = 1;
+
+		if(::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value)))
+			this->stats_add("setsockopt keepalive failures");
+		else
 		{
-			si6_addr_length = sizeof(si6_addr);
+			value = this->keepalive_idle_s;
 
-			if((socket_fd = accept(accept_fd, (struct sockaddr *)&si6_addr, &si6_addr_length)) < 0)
-			{
-				this->stats["connections failed"]++;
+			if(::setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &value, sizeof(value)))
+				this->stats_add("setsockopt keepidle failures");
+
+			value = keepalive_interval_s;
+
+			if(::setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &value, sizeof(value)))
+				this->stats_add("setsockopt keepintvl failures");
+
+			value = keepalive_count;
+
+			if(::setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &value, sizeof(value)))
+				this->stats_add("setsockopt keepcnt failures");
+		}
+	}
+}
+
+// Connections without any traffic for idle_timeout_s seconds are closed, this also catches
+// peers that disappeared without the keepalive probes being enabled.
+
+void TCP::connection_reap_idle()
+{
+	std::int64_t now, time_active;
+
+	if(this->idle_timeout_s == 0)
+		return;
+
+	now = esp_timer_get_time();
+
+	for(auto &connection : this->connections)
+	{
+		{
+			std::scoped_lock lock(this->connections_mutex);
+
+			if((connection.fd < 0) || connection.closing)
 				continue;
-			}
 
-			this->stats["connections accepted"]++;
+			time_active = connection.time_active;
+		}
 
-			for(;;)
-			{
-				receive_buffer.clear();
+		if((now - time_active) > (this->idle_timeout_s * 1000000LL))
+		{
+			this->stats_add("connections idle timeout");
+			this->connection_close(connection);
+		}
+	}
+}
 
-				pfd.fd = this->socket_fd;
-				pfd.events = POLLIN;
-				pfd.revents = 0;
+// Called from the tcp thread only. A reply that's being sent at this moment still uses the fd,
+// so it's only shut down here, which also makes the blocked send return, and released by the sender.
 
-				rv = poll(&pfd, 1, -1);
+void TCP::connection_close(connection_t &connection)
+{
+	std::scoped_lock lock(this->connections_mutex);
 
-				if(rv < 0)
-				{
-					this->log.log_errno(errno, "tcp: poll error");
-					this->stats["poll generic error"]++;
-					break;
-				}
+	std::string().swap(connection.receive_buffer);
+	connection.receive_offset = 0;
 
-				if(!(pfd.revents & POLLIN))
-				{
-					this->log.log_errno(errno, "tcp: socket error");
-					this->stats["poll receive error"]++;
-					break;
-				}
+	this->stats["connections closed"]++;
+
+	if(connection.senders > 0)
+	{
+		::shutdown(connection.fd, SHUT_RDWR);
+		connection.closing = true;
+		this->stats["connections closed while sending"]++;
+		return;
+	}
 
-				if(ioctl(this->socket_fd, FIONREAD, &length))
-					throw(hard_exception("tcp: ioctl fionread"));
+	this->connection_release(connection);
+}
 
-				receive_buffer.clear();
-				receive_buffer.resize(length);
+// connections_mutex must be held
 
-				length = ::recv(this->socket_fd, receive_buffer.data(), receive_buffer.size(), 0);
+void TCP::connection_release(connection_t &connection)
+{
+	::close(connection.fd);
+	connection.fd = -1;
+	connection.closing = false;
+}
 
-				if(length < 0)
-				{
-					this->stats["receive errors"]++;
-					break;
-				}
+// The stream is received directly at the end of the connection's buffer and then parsed for
+// any number of complete packets, so pipelined requests in one segment are all handled.
+// Data of an incomplete packet is moved to the front of the buffer before the next receive.
 
-				if(length == 0)
-				{
-					this->stats["receive zero size packets"]++;
-					this->log << "tcp: zero packet received";
-					break;
-				}
+void TCP::connection_receive(connection_t &connection, short revents)
+{
+	std::string header;
+	std::string::size_type filled;
+	unsigned int packet_length, packets;
+	std::int64_t now;
+	int length;
 
-				receive_buffer.resize(length);
+	if(!(revents & POLLIN))
+	{
+		this->stats_add("poll receive error");
+		this->connection_close(connection);
+		return;
+	}
 
-				this->stats["receive bytes"] += length;
+	if(ioctl(connection.fd, FIONREAD, &length))
+		throw(hard_exception("tcp: ioctl fionread"));
 
-				if(!Packet::valid(receive_buffer))
-				{
-					this->stats["receive invalid packet"]++;
-					continue;
-				}
+	now = esp_timer_get_time();
 
-				if(!Packet::complete(receive_buffer))
-				{
-					int offset, pending;
-
-					offset = length;
-					pending = Packet::length(receive_buffer) - offset;
-					receive_buffer.resize(Packet::length(receive_buffer));
-
-					while(pending > 0)
-					{
-						pfd.fd = this->socket_fd;
-						pfd.events = POLLIN;
-						pfd.revents = 0;
-
-						rv = poll(&pfd, 1, 1000);
-
-						if(rv < 0)
-						{
-							this->log.log_errno(errno, "tcp: poll error (2)");
-							this->stats["receive fragment poll failures"]++;
-							break;
-						}
-
-						if(rv == 0)
-						{
-							this->log << "tcp: timeout";
-							this->stats["receive fragment poll timeouts"]++;
-							break;
-						}
-
-						if(!(pfd.revents & POLLIN))
-						{
-							this->log.log_errno(errno, "tcp: socket error (2)");
-							this->stats["receive fragment poll errors"]++;
-							break;
-						}
-
-						length = ::recv(this->socket_fd, receive_buffer.data() + offset, pending, 0);
-
-						if(length == 0)
-							break;
-
-						if(length < 0)
-						{
-							this->log << std::format("tcp: receive error (2): {:d}", length);
-							this->stats["receive fragment receive errors"]++;
-							break;
-						}
-
-						pending -= length;
-						offset += length;
-					}
-
-					if(!Packet::complete(receive_buffer))
-					{
-						this->log << "tcp: packet incomplete";
-						this->stats["receive packets incomplete"]++;
-						continue;
-					}
+	if((connection.receive_buffer.size() > connection.receive_offset) && ((now - connection.time_received) > (receive_timeout_ms * 1000LL)))
+	{
+		this->log << "tcp: packet incomplete";
+		this->stats_add("receive packets incomplete");
+		connection.receive_buffer.clear();
+		connection.receive_offset = 0;
+	}
 
-					length = Packet::length(receive_buffer);
-					receive_buffer.resize(length);
-				}
+	if(connection.receive_offset > 0)
+	{
+		connection.receive_buffer.erase(0, connection.receive_offset);
+		connection.receive_offset = 0;
+		this->stats_add("receive buffer compactions");
+	}
 
-				command_response_t *command_response = new command_response_t;
+	filled = connection.receive_buffer.size();
+	connection.receive_buffer.resize(filled + length);
 
-				static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr));
-				static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr_in));
-				static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr_in6));
+	length = ::recv(connection.fd, connection.receive_buffer.data() + filled, length, 0);
 
-				memcpy(&command_response->ip.address.sin6_addr, &si6_addr, si6_addr_length);
-				command_response->ip.address.sin6_length = si6_addr_length;
-				command_response->source = cli_source_wlan_tcp;
-				command_response->mtu = this->mtu;
-				command_response->packetised = 1;
-				command_response->packet = receive_buffer;
+	if(length < 0)
+	{
+		this->stats_add("receive errors");
+		this->connection_close(connection);
+		return;
+	}
 
-				this->command->receive_queue_push(command_response);
+	if(length == 0)
+	{
+		this->connection_close(connection);
+		return;
+	}
 
-				command_response = nullptr;
-				receive_buffer.clear();
+	connection.receive_buffer.resize(filled + length);
+	connection.time_received = now;
 
-				this->stats["receive packets"]++;
+	{
+		std::scoped_lock lock(this->connections_mutex);
+
+		connection.time_active = now;
+		connection.receive_bytes += length;
+		this->stats["receive bytes"] += length;
+		this->stats["receive reads"]++;
+	}
+
+	for(packets = 0; (connection.receive_buffer.size() - connection.receive_offset) >= Packet::packet_header_size(); packets++)
+	{
+		header.assign(connection.receive_buffer, connection.receive_offset, Packet::packet_header_size());
+
+		if(!Packet::valid(header) || ((packet_length = Packet::length(header)) > (receive_packet_size_factor * this->mtu)))
+		{
+			this->stats_add("receive invalid packet");
+			connection.receive_buffer.clear();
+			connection.receive_offset = 0;
+			break;
+		}
+
+		if((connection.receive_buffer.size() - connection.receive_offset) < packet_length)
+			break;
+
+		command_response_t *command_response = this->command->response_pool_get();
+
+		static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr));
+		static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr_in));
+		static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr_in6));
+
+		memcpy(&command_response->ip.address.sin6_addr, &connection.address, connection.address_length);
+		command_response->ip.address.sin6_length = connection.address_length;
+		command_response->ip.connection = connection.id;
+		command_response->source = cli_source_wlan_tcp;
+		command_response->mtu = this->mtu;
+		command_response->packetised = 1;
+
+		if((connection.receive_offset == 0) && (connection.receive_buffer.size() == packet_length))
+		{
+			command_response->packet.swap(connection.receive_buffer);
+			connection.receive_buffer.clear();
+		}
+		else
+		{
+			command_response->packet.assign(connection.receive_buffer, connection.receive_offset, packet_length);
+			connection.receive_offset += packet_length;
+		}
+
+		this->command->receive_queue_push(command_response, false);
+
+		command_response = nullptr;
+	}
+
+	if(packets > 0)
+	{
+		std::scoped_lock lock(this->connections_mutex);
+
+		connection.receive_packets += packets;
+		this->stats["receive packets"] += packets;
+
+		if(packets > 1)
+			this->stats["receive pipelined packets"] += packets - 1;
+	}
+
+	if(connection.receive_offset >= connection.receive_buffer.size())
+	{
+		connection.receive_buffer.clear();
+		connection.receive_offset = 0;
+	}
+}
+
+void TCP::thread_runner()
+{
+	int accept_fd, rv;
+	unsigned int ix, nfds;
+	struct sockaddr_in6 si6_addr;
+	std::array<struct pollfd, connections_max + 1> pfd;
+	std::array<unsigned int, connections_max + 1> pfd_connection;
+
+	try
+	{
+		if(!this->command)
+			throw(hard_exception("TCP::thread_runner: command not set"));
+
+		if((accept_fd = ::socket(AF_INET6, SOCK_STREAM, 0)) < 0)
+			throw(transient_exception(this->log.errno_string_error(errno, "TCP::thread_runner: socket")));
+
+		memset(&si6_addr, 0, sizeof(si6_addr));
+		si6_addr.sin6_family = AF_INET6;
+		si6_addr.sin6_port = htons(24);
+
+		if(::bind(accept_fd, reinterpret_cast<const struct sockaddr *>(&si6_addr), sizeof(si6_addr)) != 0)
+			throw(transient_exception(this->log.errno_string_error(errno, "TCP::thread_runner: bind")));
+
+		if(::listen(accept_fd, connections_max) != 0)
+			throw(transient_exception(this->log.errno_string_error(errno, "TCP::thread_runner: listen")));
+
+		for(;;)
+		{
+			nfds = 0;
+
+			pfd[nfds].fd = accept_fd;
+			pfd[nfds].events = POLLIN;
+			pfd[nfds].revents = 0;
+			nfds++;
+
+			{
+				std::scoped_lock lock(this->connections_mutex); // the send thread may release a closing connection
+
+				for(ix = 0; ix < connections_max; ix++)
+				{
+					if((this->connections[ix].fd < 0) || this->connections[ix].closing)
+						continue;
+
+					pfd[nfds].fd = this->connections[ix].fd;
+					pfd[nfds].events = POLLIN;
+					pfd[nfds].revents = 0;
+					pfd_connection[nfds] = ix;
+					nfds++;
+				}
 			}
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(100));
-			close(socket_fd);
-			socket_fd = -1;
+			rv = poll(pfd.data(), nfds, ((nfds > 1) && (this->idle_timeout_s > 0)) ? reap_interval_ms : -1);
+
+			if(rv < 0)
+			{
+				this->log.log_errno(errno, "tcp: poll error");
+				this->stats_add("poll generic error");
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				continue;
+			}
+
+			for(ix = 1; ix < nfds; ix++)
+				if(pfd[ix].revents)
+					this->connection_receive(this->connections[pfd_connection[ix]], pfd[ix].revents);
+
+			if(pfd[0].revents & POLLIN)
+				this->connection_accept(accept_fd);
+
+			this->connection_reap_idle();
 		}
 
 		throw(hard_exception("tcp threadrunner: loop breaks"));
@@ -269,22 +500,51 @@ void TCP::thread_runner()
 		(void)0;
 }
 
+// Only the connection's fd and id are taken under the lock, the data is sent without holding it,
+// so the tcp thread and other clients' replies don't wait for a slow peer. The slot is kept
+// reserved (senders) until the send is done, so the fd can't be closed and reused meanwhile.
+// The packet is sent as the one contiguous buffer Packet::encapsulate produced. Sending header and payload
+// as separate iovecs (sendmsg) needs Packet to encapsulate just the header, which it doesn't offer (yet).
+
 void TCP::send(const command_response_t *command_response)
 {
-	int length, offset, chunk_length, sent;
+	int length, offset, chunk_length, sent, flags, fd;
+	unsigned int id, segments, bytes;
+	bool failed;
+	connection_t *connection;
 
 	if(!command_response)
 		throw(hard_exception("TCP::send: invalid argument"));
 
-	if(socket_fd < 0)
 	{
-		this->stats["send no connection"]++;
-		return;
-	}
+		std::scoped_lock lock(this->connections_mutex);
 
-	this->stats["send packets"]++;
+		connection = nullptr;
+
+		for(auto &it : this->connections)
+		{
+			if((it.fd >= 0) && !it.closing && (it.id == command_response->ip.connection))
+			{
+				connection = &it;
+				break;
+			}
+		}
+
+		if(!connection)
+		{
+			this->stats["send no connection"]++;
+			return;
+		}
+
+		fd = connection->fd;
+		id = connection->id;
+		connection->senders++;
+	}
 
 	offset = 0;
+	segments = 0;
+	bytes = 0;
+	failed = false;
 	length = command_response->packet.length();
 
 	if(!command_response->packetised && (length > command_response->mtu))
@@ -297,18 +557,20 @@ void TCP::send(const command_response_t *command_response)
 		if(chunk_length > this->mtu)
 			chunk_length = this->mtu;
 
-		sent = ::send(socket_fd, command_response->packet.data() + offset, chunk_length, 0);
+		// let the stack coalesce segments when more data follows immediately
+		flags = ((chunk_length < length) || command_response->more) ? MSG_MORE : 0;
 
-		this->stats["send segments"]++;
+		sent = ::send(fd, command_response->packet.data() + offset, chunk_length, flags);
+
+		segments++;
 
 		if(sent <= 0)
 		{
-			this->stats["send errors"]++;
+			failed = true;
 			break;
 		}
 
-		this->stats["send bytes"] += sent;
-
+		bytes += sent;
 		length -= sent;
 		offset += sent;
 
@@ -321,10 +583,79 @@ void TCP::send(const command_response_t *command_response)
 		if(length == 0)
 			break;
 	}
+
+	std::scoped_lock lock(this->connections_mutex);
+
+	if((connection->fd != fd) || (connection->id != id) || (connection->senders == 0))
+		throw(hard_exception("TCP::send: connection slot reused while sending"));
+
+	connection->senders--;
+
+	this->stats["send packets"]++;
+	this->stats["send segments"] += segments;
+	this->stats["send bytes"] += bytes;
+
+	if(failed)
+		this->stats["send errors"]++;
+
+	if(connection->closing)
+	{
+		if(connection->senders == 0)
+			this->connection_release(*connection);
+
+		return;
+	}
+
+	connection->send_packets++;
+	connection->send_bytes += bytes;
+
+	if(bytes > 0)
+		connection->time_active = esp_timer_get_time();
 }
 
 void TCP::info(std::string &out)
 {
+	std::string address;
+	unsigned int active;
+	std::int64_t now;
+
+	std::scoped_lock lock(this->connections_mutex);
+
 	for(const auto &it : this->stats)
 		out += std::format("\n{:<32s} {:d}", it.first, it.second);
+
+	active = 0;
+
+	for(const auto &connection : this->connections)
+		if((connection.fd >= 0) && !connection.closing)
+			active++;
+
+	out += std::format("\nsettings: mtu {:d}, send buffer {}, nodelay {}, keepalive {}, idle timeout {}",
+			this->mtu,
+			this->send_buffer_size > 0 ? std::format("{:d}", this->send_buffer_size) : "default",
+			this->nodelay ? "on" : "off",
+			this->keepalive_idle_s > 0 ? std::format("{:d} s", this->keepalive_idle_s) : "off",
+			this->idle_timeout_s > 0 ? std::format("{:d} s", this->idle_timeout_s) : "off");
+
+	out += std::format("\nconnections: {:d} active, {:d} max", active, connections_max);
+
+	now = esp_timer_get_time();
+
+	for(const auto &connection : this->connections)
+	{
+		if((connection.fd < 0) || connection.closing)
+			continue;
+
+		address.resize(INET6_ADDRSTRLEN);
+
+		if(inet_ntop(AF_INET6, &connection.address.sin6_addr, address.data(), address.size()))
+			address.resize(strlen(address.c_str()));
+		else
+			address = "?";
+
+		out += std::format("\n- #{:d} [{}]:{:d}, up {:d} s, idle {:d} s, received {:d} bytes / {:d} packets, sent {:d} bytes / {:d} packets",
+				connection.id, address, ntohs(connection.address.sin6_port),
+				(now - connection.time_connected) / 1000000, (now - connection.time_active) / 1000000,
+				connection.receive_bytes, connection.receive_packets, connection.send_bytes, connection.send_packets);
+	}
 }
@@ -1,10 +1,16 @@
 #pragma once
 
 #include "log.h"
+#include "config.h"
 #include "command-response.h"
 
 #include <string>
 #include <map>
+#include <array>
+#include <mutex>
+#include <cstdint>
+
+#include <netinet/in.h>
 
 class Command;
 
@@ -14,7 +20,7 @@ class TCP final
 
 		explicit TCP() = delete;
 		explicit TCP(const TCP &) = delete;
-		explicit TCP(Log &);
+		explicit TCP(Log &, Config &);
 
 		TCP &get();
 		void set(Command *);
@@ -24,14 +30,63 @@ class TCP final
 
 	private:
 
-		static constexpr int mtu = 16 * 1024; // emperically determined
+		static constexpr int mtu_default = 16 * 1024; // emperically determined
+		static constexpr int mtu_min = 1024;
+		static constexpr int mtu_max = 32 * 1024;
+		static constexpr unsigned int connections_max = 4;
+		static constexpr int receive_timeout_ms = 1000;
+		static constexpr unsigned int receive_packet_size_factor = 4;
+		static constexpr int idle_timeout_default_s = 300;
+		static constexpr int keepalive_idle_default_s = 60;
+		static constexpr int keepalive_interval_s = 10;
+		static constexpr int keepalive_count = 3;
+		static constexpr int reap_interval_ms = 1000;
+
+		// connections_mutex guards stats and all of a connection except the receive buffer and time_received,
+		// which are only used by the tcp thread. A connection that is closed while a reply is being sent to it
+		// is shut down and marked closing, its slot and fd are released by the last sender.
+
+		struct connection_t
+		{
+			int fd;
+			unsigned int id; // unique for every connection accepted, also serves as generation of the slot
+			unsigned int senders;
+			bool closing;
+			struct sockaddr_in6 address;
+			socklen_t address_length;
+			std::string receive_buffer; // unparsed stream data starts at receive_offset
+			std::string::size_type receive_offset;
+			std::int64_t time_connected;
+			std::int64_t time_received;
+			std::int64_t time_active;
+			unsigned int receive_bytes;
+			unsigned int receive_packets;
+			unsigned int send_bytes;
+			unsigned int send_packets;
+		};
 
 		static TCP *singleton;
 		Log &log;
+		Config &config;
 		Command *command;
-		int socket_fd;
+		int mtu;
+		int send_buffer_size;
+		int idle_timeout_s;
+		int keepalive_idle_s;
+		bool nodelay;
+		std::array<connection_t, connections_max> connections;
+		std::mutex connections_mutex;
+		unsigned int connection_id_next;
 		std::map<std::string, int> stats;
 		bool running;
 
+		bool config_get(const std::string &id, int &value);
+		void stats_add(const char *name, int value = 1);
+		void connection_accept(int accept_fd);
+		void connection_options(int fd);
+		void connection_close(connection_t &connection);
+		void connection_release(connection_t &connection);
+		void connection_receive(connection_t &connection, short revents);
+		void connection_reap_idle();
 		[[noreturn]] void thread_runner();
 };
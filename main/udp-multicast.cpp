@@ -0,0 +1,149 @@
+#include "udp-multicast.h"
+
+#include <string.h> // for memset
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+
+UdpMulticast::UdpMulticast(unsigned int requests_max_in, int jitter_ms_in) : requests_max(requests_max_in)
+{
+	this->jitter(jitter_ms_in);
+}
+
+// Only multicast addresses (ff00::/8) are accepted as group.
+
+bool UdpMulticast::group(const std::string &text, struct in6_addr &address)
+{
+	return((inet_pton(AF_INET6, text.c_str(), &address) == 1) && (address.s6_addr[0] == 0xff));
+}
+
+// The multicast socket uses its own port, because lwIP can't tell on which address a datagram
+// arrived, and requests received on it must be treated differently. Returns -1 and leaves errno
+// set on failure.
+
+int UdpMulticast::open(unsigned int port, bool reuse)
+{
+	struct sockaddr_in6 si6_addr;
+	int fd, error, on;
+
+	if((fd = ::socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+		return(-1);
+
+	on = 1;
+
+	if(reuse && (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0))
+	{
+		error = errno;
+		::close(fd);
+		errno = error;
+		return(-1);
+	}
+
+	memset(&si6_addr, 0, sizeof(si6_addr));
+	si6_addr.sin6_family = AF_INET6;
+	si6_addr.sin6_port = htons(port);
+
+	if(::bind(fd, reinterpret_cast<const struct sockaddr *>(&si6_addr), sizeof(si6_addr)) != 0)
+	{
+		error = errno;
+		::close(fd);
+		errno = error;
+		return(-1);
+	}
+
+	return(fd);
+}
+
+// Joining fails while the network interface isn't up yet, the caller should retry.
+
+bool UdpMulticast::join(int fd, const struct in6_addr &group_address, unsigned int interface)
+{
+	struct ipv6_mreq mreq;
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.ipv6mr_multiaddr = group_address;
+	mreq.ipv6mr_interface = interface;
+
+	return(::setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) == 0);
+}
+
+int UdpMulticast::reply(int fd, const struct sockaddr *address, socklen_t address_length, const std::string &packet)
+{
+	return(::sendto(fd, packet.data(), packet.size(), 0, address, address_length));
+}
+
+void UdpMulticast::jitter(int jitter_ms_in)
+{
+	this->jitter_ms = std::max(jitter_ms_in, 0);
+}
+
+int UdpMulticast::jitter() const
+{
+	return(this->jitter_ms);
+}
+
+// Returns false when the queue is full and the request is dropped.
+
+bool UdpMulticast::push(const std::string &packet, const struct sockaddr_in6 &address, socklen_t address_length, std::int64_t now, unsigned int random)
+{
+	std::scoped_lock lock(this->requests_mutex);
+
+	if(this->requests.size() >= this->requests_max)
+		return(false);
+
+	request_t &request = this->requests.emplace_back();
+
+	request.address = address;
+	request.address_length = address_length;
+	request.packet = packet;
+	request.time_due = now + ((random % (this->jitter_ms + 1)) * 1000LL);
+
+	return(true);
+}
+
+// Moves the requests that are due to due, in the order they were received.
+
+void UdpMulticast::release(std::int64_t now, std::deque<request_t> &due)
+{
+	std::deque<request_t>::iterator it;
+	std::scoped_lock lock(this->requests_mutex);
+
+	for(it = this->requests.begin(); it != this->requests.end();)
+	{
+		if(it->time_due > now)
+		{
+			it++;
+			continue;
+		}
+
+		due.push_back(std::move(*it));
+		it = this->requests.erase(it);
+	}
+}
+
+// Milliseconds until the first request is due, rounded up, -1 when nothing is queued.
+
+int UdpMulticast::timeout(std::int64_t now)
+{
+	std::int64_t due;
+	std::scoped_lock lock(this->requests_mutex);
+
+	if(this->requests.empty())
+		return(-1);
+
+	due = this->requests.front().time_due;
+
+	for(const auto &request : this->requests)
+		due = std::min(due, request.time_due);
+
+	return(std::max((due - now + 999) / 1000, static_cast<std::int64_t>(0)));
+}
+
+unsigned int UdpMulticast::pending()
+{
+	std::scoped_lock lock(this->requests_mutex);
+
+	return(this->requests.size());
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <cstdint>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Requests sent to a multicast group: the socket on the multicast port, the group membership and the queue
+// that holds each request for a random time of up to the jitter before it's handled, so the replies of many
+// devices are spread out. Replies are sent unicast, from the regular socket.
+// Depends on nothing but the standard library and the socket API, so it can also be built and exercised on the host.
+// The caller supplies the time (in microseconds) and the random numbers.
+
+class UdpMulticast final
+{
+	public:
+
+		struct request_t
+		{
+			struct sockaddr_in6 address;
+			socklen_t address_length;
+			std::string packet;
+			std::int64_t time_due;
+		};
+
+		explicit UdpMulticast() = delete;
+		explicit UdpMulticast(const UdpMulticast &) = delete;
+		explicit UdpMulticast(unsigned int requests_max, int jitter_ms);
+
+		static bool group(const std::string &text, struct in6_addr &address);
+		static int open(unsigned int port, bool reuse = false);
+		static bool join(int fd, const struct in6_addr &group, unsigned int interface = 0);
+		static int reply(int fd, const struct sockaddr *address, socklen_t address_length, const std::string &packet);
+
+		void jitter(int jitter_ms);
+		int jitter() const;
+		bool push(const std::string &packet, const struct sockaddr_in6 &address, socklen_t address_length, std::int64_t now, unsigned int random);
+		void release(std::int64_t now, std::deque<request_t> &due);
+		int timeout(std::int64_t now);
+		unsigned int pending();
+
+	private:
+
+		unsigned int requests_max;
+		int jitter_ms;
+		std::deque<request_t> requests;
+		std::mutex requests_mutex;
+};
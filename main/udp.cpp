@@ -8,20 +8,32 @@
 #include <string.h> // for memcpy
 #include <sys/socket.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
 
 #include <esp_pthread.h>
+#include <esp_timer.h>
+#include <esp_random.h>
 
 #include <thread>
-#include <chrono>
+#include <tuple>
+#include <algorithm>
 
 UDP *UDP::singleton = nullptr;
 
-UDP::UDP(Log &log_in) : log(log_in)
+UDP::UDP(Log &log_in, Config &config_in) : log(log_in), config(config_in), multicast_requests(multicast_requests_max, multicast_jitter_default_ms)
 {
 	if(this->singleton)
 		throw(hard_exception("UDP: already active"));
 
 	this->socket_fd = -1;
+	this->multicast_fd = -1;
+	this->multicast_port = multicast_port_default;
+	this->multicast_joined = false;
+	this->multicast_join_time = 0;
+	this->reassembly_memory = 0;
+	this->sent_messages_memory = 0;
+	this->message_id_next = 0;
 	this->running = false;
 	this->command = nullptr;
 	this->singleton = this;
@@ -51,9 +63,36 @@ void UDP::run()
 	if(this->running)
 		throw(hard_exception("UDP::run: already running"));
 
+	try
+	{
+		this->multicast_group = this->config.get_string("udp.mcast");
+	}
+	catch(const transient_exception &)
+	{
+		this->multicast_group.clear();
+	}
+
+	try
+	{
+		this->multicast_port = this->config.get_int("udp.mcast.port");
+	}
+	catch(const transient_exception &)
+	{
+		this->multicast_port = multicast_port_default;
+	}
+
+	try
+	{
+		this->multicast_requests.jitter(this->config.get_int("udp.mcast.jit"));
+	}
+	catch(const transient_exception &)
+	{
+		this->multicast_requests.jitter(multicast_jitter_default_ms);
+	}
+
 	thread_config.thread_name = "udp";
 	thread_config.pin_to_core = 1;
-	thread_config.stack_size = 2 * 1024;
+	thread_config.stack_size = 3 * 1024;
 	thread_config.prio = 1;
 	thread_config.stack_alloc_caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
 
@@ -67,107 +106,638 @@ void UDP::run()
 	new_thread.detach();
 }
 
-void UDP::thread_runner()
+unsigned int UDP::get_le16(const std::string &data, unsigned int offset)
 {
-	std::string receive_buffer;
-	int rv, length;
-	struct sockaddr_in6 si6_addr;
-	socklen_t si6_addr_length;
-	struct pollfd pfd;
+	return(static_cast<std::uint8_t>(data[offset + 0]) | (static_cast<std::uint8_t>(data[offset + 1]) << 8));
+}
 
-	try
+void UDP::set_le16(std::string &data, unsigned int offset, unsigned int value)
+{
+	data[offset + 0] = (value >> 0) & 0xff;
+	data[offset + 1] = (value >> 8) & 0xff;
+}
+
+bool UDP::address_equal(const struct sockaddr_in6 &a, socklen_t a_length, const struct sockaddr_in6 &b, socklen_t b_length)
+{
+	return((a_length == b_length) && (memcmp(&a, &b, a_length) == 0));
+}
+
+void UDP::stats_add(const char *name, int value)
+{
+	std::scoped_lock lock(this->stats_mutex);
+
+	this->stats[name] += value;
+}
+
+void UDP::stats_max(const char *name, int value)
+{
+	std::scoped_lock lock(this->stats_mutex);
+
+	if(this->stats[name] < value)
+		this->stats[name] = value;
+}
+
+void UDP::deliver(command_response_t *command_response, const struct sockaddr_in6 &address, socklen_t address_length, bool fragmented)
+{
+	static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr));
+	static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr_in));
+	static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr_in6));
+
+	memcpy(&command_response->ip.address.sin6_addr, &address, address_length);
+	command_response->ip.address.sin6_length = address_length;
+	command_response->ip.fragmented = fragmented;
+
+	command_response->source = cli_source_wlan_udp;
+	command_response->packetised = 1;
+	command_response->mtu = fragmented ? fragmented_mtu : this->mtu;
+
+	this->command->receive_queue_push(command_response, false);
+
+	command_response = nullptr;
+
+	this->stats_add("receive packets");
+}
+
+// Fragments of a request are collected per sender and message id. Reassembly memory is bounded,
+// fragments that do not fit are dropped and will be requested again through a retransmit request
+// when no progress was made for reassembly_timeout_ms. Fragments that arrive late for a request that
+// has already been completed are dropped.
+
+void UDP::fragment_receive(const std::string &datagram, const struct sockaddr_in6 &address, socklen_t address_length)
+{
+	unsigned int id, index, count, length;
+	std::vector<reassembly_t>::iterator it;
+	command_response_t *command_response;
+	std::string packet;
+	std::int64_t now;
+
+	id = this->get_le16(datagram, 2);
+	index = this->get_le16(datagram, 4);
+	count = this->get_le16(datagram, 6);
+	length = datagram.size() - fragment_header_size;
+
+	if((count == 0) || (count > fragments_max) || (index >= count) || (length == 0) || (length > fragment_payload_size))
 	{
-		if(!this->command)
-			throw(hard_exception("UDP::thread_runner: command not set"));
+		this->stats_add("fragments invalid");
+		return;
+	}
 
-		if((this->socket_fd = ::socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
-			throw(transient_exception(this->log.errno_string_error(errno, "UDP::thread_runner: socket")));
+	this->stats_add("fragments received");
 
-		memset(&si6_addr, 0, sizeof(si6_addr));
-		si6_addr.sin6_family = AF_INET6;
-		si6_addr.sin6_port = htons(24);
+	now = esp_timer_get_time();
 
-		if(::bind(this->socket_fd, reinterpret_cast<const struct sockaddr *>(&si6_addr), sizeof(si6_addr)) != 0)
-			throw(transient_exception(this->log.errno_string_error(errno, "UDP::thread_runner: bind")));
+	{
+		std::scoped_lock lock(this->state_mutex);
 
-		for(;;)
+		for(it = this->reassemblies.begin(); it != this->reassemblies.end(); it++)
+			if((it->id == id) && this->address_equal(it->address, it->address_length, address, address_length))
+				break;
+
+		if(it == this->reassemblies.end())
+		{
+			for(const auto &done : this->completed)
+			{
+				if((done.id == id) && this->address_equal(done.address, done.address_length, address, address_length))
+				{
+					this->stats_add("fragments late");
+					return;
+				}
+			}
+
+			if(this->reassemblies.size() >= reassemblies_max)
+			{
+				this->stats_add("fragments dropped no reassembly slot");
+				return;
+			}
+
+			it = this->reassemblies.emplace(this->reassemblies.end());
+			it->address = address;
+			it->address_length = address_length;
+			it->id = id;
+			it->count = count;
+			it->received = 0;
+			it->bytes = 0;
+			it->retransmits = 0;
+			it->fragments.resize(count);
+		}
+
+		if(it->count != count)
 		{
-			si6_addr_length = sizeof(si6_addr);
+			this->stats_add("fragments invalid");
+			return;
+		}
 
-			pfd.fd = this->socket_fd;
-			pfd.events = POLLIN;
-			pfd.revents = 0;
+		if(!it->fragments[index].empty())
+		{
+			this->stats_add("fragments duplicate");
+			return;
+		}
 
-			rv = poll(&pfd, 1, -1);
+		if((this->reassembly_memory + length) > reassembly_memory_max)
+		{
+			this->stats_add("fragments dropped memory full");
+			return;
+		}
 
-			if(rv < 0)
+		it->fragments[index].assign(datagram, fragment_header_size, length);
+		it->received++;
+		it->bytes += length;
+		it->time_updated = now;
+
+		this->reassembly_memory += length;
+
+		this->stats_max("reassembly memory max", this->reassembly_memory);
+
+		if(it->received < it->count)
+			return;
+
+		packet.reserve(it->bytes);
+
+		for(const auto &fragment : it->fragments)
+			packet.append(fragment);
+
+		this->reassembly_memory -= it->bytes;
+		this->reassemblies.erase(it);
+
+		if(this->completed.size() >= completed_max)
+			this->completed.pop_front();
+
+		completed_t &done = this->completed.emplace_back();
+
+		done.address = address;
+		done.address_length = address_length;
+		done.id = id;
+		done.time_completed = now;
+	}
+
+	if(!Packet::valid(packet) || !Packet::complete(packet))
+	{
+		this->stats_add("reassembly invalid packets");
+		return;
+	}
+
+	this->stats_add("reassembly packets");
+
+	command_response = this->command->response_pool_get();
+	command_response->packet.swap(packet);
+	this->deliver(command_response, address, address_length, true);
+}
+
+void UDP::fragment_send(const sent_message_t &message, unsigned int index)
+{
+	std::string header;
+	struct iovec iov[2];
+	struct msghdr msg;
+	unsigned int offset, count;
+	int sent;
+
+	count = (message.packet->size() + fragment_payload_size - 1) / fragment_payload_size;
+	offset = index * fragment_payload_size;
+
+	header.resize(fragment_header_size);
+	header[0] = fragment_marker;
+	header[1] = fragment_type_data;
+	this->set_le16(header, 2, message.id);
+	this->set_le16(header, 4, index);
+	this->set_le16(header, 6, count);
+
+	iov[0].iov_base = header.data();
+	iov[0].iov_len = header.size();
+	iov[1].iov_base = const_cast<char *>(message.packet->data() + offset);
+	iov[1].iov_len = std::min(static_cast<unsigned int>(message.packet->size()) - offset, fragment_payload_size);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = const_cast<struct sockaddr_in6 *>(&message.address);
+	msg.msg_namelen = message.address_length;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	sent = ::sendmsg(this->socket_fd, &msg, 0);
+
+	if(sent <= 0)
+	{
+		this->stats_add("send errors");
+		return;
+	}
+
+	std::scoped_lock lock(this->stats_mutex);
+
+	this->stats["send fragments"]++;
+	this->stats["send bytes"] += sent;
+}
+
+std::string UDP::retransmit_request(const reassembly_t &reassembly)
+{
+	std::string request;
+	unsigned int ix, missing;
+
+	request.resize(fragment_header_size);
+	request[0] = fragment_marker;
+	request[1] = fragment_type_retransmit;
+	set_le16(request, 2, reassembly.id);
+	set_le16(request, 4, 0);
+
+	for(ix = 0, missing = 0; ix < reassembly.count; ix++)
+	{
+		if(!reassembly.fragments[ix].empty())
+			continue;
+
+		request.resize(request.size() + 2);
+		set_le16(request, request.size() - 2, ix);
+		missing++;
+	}
+
+	set_le16(request, 6, missing);
+
+	return(request);
+}
+
+void UDP::retransmit_request_receive(const std::string &datagram, const struct sockaddr_in6 &address, socklen_t address_length)
+{
+	unsigned int id, count, ix, index;
+	sent_message_t message;
+	bool found;
+
+	id = this->get_le16(datagram, 2);
+	count = this->get_le16(datagram, 6);
+
+	if((count > fragments_max) || (datagram.size() != (fragment_header_size + (count * 2))))
+	{
+		this->stats_add("retransmit requests invalid");
+		return;
+	}
+
+	this->stats_add("retransmit requests received");
+
+	found = false;
+
+	{
+		std::scoped_lock lock(this->sent_messages_mutex);
+
+		for(const auto &it : this->sent_messages)
+		{
+			if((it.id == id) && this->address_equal(it.address, it.address_length, address, address_length))
 			{
-				this->log.log_errno(errno, "udp: poll error");
-				this->stats["poll generic error"]++;
-				continue;
+				message = it;
+				found = true;
+				break;
 			}
+		}
+	}
 
-			if(!(pfd.revents & POLLIN))
-				throw(hard_exception("udp: socket error"));
+	if(!found)
+	{
+		this->stats_add("retransmit requests expired");
+		return;
+	}
 
-			if(ioctl(this->socket_fd, FIONREAD, &length))
-				throw(hard_exception("udp: ioctl fionread"));
+	for(ix = 0; ix < count; ix++)
+	{
+		index = this->get_le16(datagram, fragment_header_size + (ix * 2));
 
-			receive_buffer.clear();
-			receive_buffer.resize(length);
+		if((index * fragment_payload_size) < message.packet->size())
+		{
+			this->fragment_send(message, index);
+			this->stats_add("send fragments retransmitted");
+		}
+	}
+}
 
-			length = ::recvfrom(this->socket_fd, receive_buffer.data(), receive_buffer.size(), 0, reinterpret_cast<sockaddr *>(&si6_addr), &si6_addr_length);
+void UDP::housekeeping()
+{
+	std::vector<reassembly_t>::iterator it;
+	std::vector<std::tuple<struct sockaddr_in6, socklen_t, std::string>> requests;
+	std::int64_t now;
 
-			if(length < 0)
+	now = esp_timer_get_time();
+
+	{
+		std::scoped_lock lock(this->state_mutex);
+
+		for(it = this->reassemblies.begin(); it != this->reassemblies.end();)
+		{
+			if((now - it->time_updated) < (reassembly_timeout_ms * 1000LL))
 			{
-				this->stats["receive errors"]++;
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				it++;
 				continue;
 			}
 
-			if(length == 0)
+			if(it->retransmits >= reassembly_retransmits_max)
 			{
-				this->stats["receive zero size packets"]++;
-				this->log << "udp: zero packet received";
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				this->stats_add("reassembly timeouts");
+				this->reassembly_memory -= it->bytes;
+				it = this->reassemblies.erase(it);
 				continue;
 			}
 
-			receive_buffer.resize(length);
+			requests.emplace_back(it->address, it->address_length, this->retransmit_request(*it));
+			it->retransmits++;
+			it->time_updated = now;
+			it++;
+		}
+
+		while(!this->completed.empty() && ((now - this->completed.front().time_completed) > (completed_retain_ms * 1000LL)))
+			this->completed.pop_front();
+	}
+
+	for(const auto &[address, address_length, request] : requests)
+	{
+		if(::sendto(this->socket_fd, request.data(), request.size(), 0, reinterpret_cast<const struct sockaddr *>(&address), address_length) <= 0)
+			this->stats_add("send errors");
+		else
+			this->stats_add("retransmit requests sent");
+	}
+
+	this->multicast_release();
+
+	if((this->multicast_fd >= 0) && !this->multicast_joined && ((now - this->multicast_join_time) > (multicast_join_retry_ms * 1000LL)))
+		this->multicast_join();
+
+	std::scoped_lock lock(this->sent_messages_mutex);
+
+	while(!this->sent_messages.empty() && ((now - this->sent_messages.front().time_sent) > (sent_message_retain_ms * 1000LL)))
+	{
+		this->sent_messages_memory -= this->sent_messages.front().packet->size();
+		this->sent_messages.pop_front();
+	}
+}
+
+void UDP::datagram_receive(const std::string &datagram, const struct sockaddr_in6 &address, socklen_t address_length)
+{
+	command_response_t *command_response;
+
+	if(!Packet::valid(datagram))
+	{
+		if((datagram.size() >= fragment_header_size) && (static_cast<std::uint8_t>(datagram[0]) == fragment_marker))
+		{
+			if(static_cast<std::uint8_t>(datagram[1]) == fragment_type_data)
+				this->fragment_receive(datagram, address, address_length);
+			else
+				if(static_cast<std::uint8_t>(datagram[1]) == fragment_type_retransmit)
+					this->retransmit_request_receive(datagram, address, address_length);
+				else
+					this->stats_add("fragments invalid");
+
+			return;
+		}
+
+		this->stats_add("receive invalid packets");
+		return;
+	}
+
+	if(!Packet::complete(datagram))
+	{
+		this->stats_add("receive incomplete packets");
+		return;
+	}
+
+	command_response = this->command->response_pool_get();
+	command_response->packet.assign(datagram);
+	this->deliver(command_response, address, address_length, false);
+}
+
+void UDP::multicast_open()
+{
+	int fd;
+
+	if(!UdpMulticast::group(this->multicast_group, this->multicast_address))
+	{
+		this->log << std::format("udp: invalid multicast group: {}, multicast disabled", this->multicast_group);
+		return;
+	}
+
+	if((fd = UdpMulticast::open(this->multicast_port)) < 0)
+	{
+		this->log.log_errno(errno, "udp: multicast socket, multicast disabled");
+		return;
+	}
+
+	this->multicast_fd = fd;
+	this->multicast_join();
+}
+
+void UDP::multicast_join()
+{
+	this->multicast_join_time = esp_timer_get_time();
+
+	// joining fails while the network interface isn't up yet, it's retried from housekeeping
+
+	if(!UdpMulticast::join(this->multicast_fd, this->multicast_address))
+	{
+		this->stats_add("multicast join failures");
+		return;
+	}
+
+	{
+		std::scoped_lock lock(this->state_mutex);
+
+		this->multicast_joined = true;
+	}
+
+	this->stats_add("multicast joins");
+}
+
+void UDP::multicast_receive(const std::string &datagram, const struct sockaddr_in6 &address, socklen_t address_length)
+{
+	if(!Packet::valid(datagram) || !Packet::complete(datagram))
+	{
+		this->stats_add("multicast invalid packets");
+		return;
+	}
 
-			this->stats["receive bytes"] += length;
+	if(!this->multicast_requests.push(datagram, address, address_length, esp_timer_get_time(), esp_random()))
+	{
+		this->stats_add("multicast requests dropped");
+		return;
+	}
+
+	this->stats_add("multicast requests received");
+}
+
+void UDP::multicast_release()
+{
+	std::deque<UdpMulticast::request_t> due;
+	command_response_t *command_response;
+
+	this->multicast_requests.release(esp_timer_get_time(), due);
+
+	for(auto &request : due)
+	{
+		command_response = this->command->response_pool_get();
+		command_response->packet.swap(request.packet);
+		this->deliver(command_response, request.address, request.address_length, false);
+	}
+}
+
+// Runs on the udp thread, which is the only one that changes reassemblies, so it can read them
+// without taking state_mutex.
+
+int UDP::poll_timeout()
+{
+	int timeout, due;
+
+	timeout = -1;
+
+	if(!this->reassemblies.empty() || !this->completed.empty())
+		timeout = housekeeping_interval_ms;
+	else
+	{
+		std::scoped_lock lock(this->sent_messages_mutex);
+
+		if(!this->sent_messages.empty())
+			timeout = housekeeping_interval_ms;
+	}
+
+	if((this->multicast_fd >= 0) && !this->multicast_joined && ((timeout < 0) || (timeout > multicast_join_retry_ms)))
+		timeout = multicast_join_retry_ms;
 
-			if(!Packet::valid(receive_buffer))
+	if(((due = this->multicast_requests.timeout(esp_timer_get_time())) >= 0) && ((timeout < 0) || (due < timeout)))
+		timeout = due;
+
+	return(timeout);
+}
+
+// Drain all pending datagrams, the buffer keeps its allocation between datagrams.
+
+void UDP::socket_drain(int fd, std::string &receive_buffer, bool multicast)
+{
+	struct sockaddr_in6 si6_addr;
+	socklen_t si6_addr_length;
+	unsigned int batch, bytes, zero, overruns, errors;
+	int length;
+
+	bytes = zero = overruns = errors = 0;
+
+	for(batch = 0; batch < receive_batch_max; batch++)
+	{
+		si6_addr_length = sizeof(si6_addr);
+
+		receive_buffer.resize_and_overwrite(this->mtu + 1,
+				[&](char *data, std::size_t size)
+				{
+					length = ::recvfrom(fd, data, size, MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&si6_addr), &si6_addr_length);
+					return((length > 0) ? length : 0);
+				});
+
+		if(length < 0)
+		{
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				errors++;
+
+			break;
+		}
+
+		if(length == 0)
+		{
+			zero++;
+			continue;
+		}
+
+		if(length > this->mtu)
+		{
+			overruns++;
+			continue;
+		}
+
+		bytes += length;
+
+		if(multicast)
+			this->multicast_receive(receive_buffer, si6_addr, si6_addr_length);
+		else
+			this->datagram_receive(receive_buffer, si6_addr, si6_addr_length);
+	}
+
+	std::scoped_lock lock(this->stats_mutex);
+
+	this->stats["receive wakeups"]++;
+	this->stats["receive bytes"] += bytes;
+
+	if(zero)
+		this->stats["receive zero size packets"] += zero;
+
+	if(overruns)
+		this->stats["receive overruns"] += overruns;
+
+	if(errors)
+		this->stats["receive errors"] += errors;
+
+	if(batch == receive_batch_max)
+		this->stats["receive batch limit reached"]++;
+
+	if(this->stats["receive batch max"] < static_cast<int>(batch))
+		this->stats["receive batch max"] = batch;
+}
+
+void UDP::thread_runner()
+{
+	std::string receive_buffer;
+	int rv;
+	unsigned int nfds;
+	struct sockaddr_in6 si6_addr;
+	struct pollfd pfd[2];
+
+	try
+	{
+		if(!this->command)
+			throw(hard_exception("UDP::thread_runner: command not set"));
+
+		if((this->socket_fd = ::socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+			throw(transient_exception(this->log.errno_string_error(errno, "UDP::thread_runner: socket")));
+
+		memset(&si6_addr, 0, sizeof(si6_addr));
+		si6_addr.sin6_family = AF_INET6;
+		si6_addr.sin6_port = htons(24);
+
+		if(::bind(this->socket_fd, reinterpret_cast<const struct sockaddr *>(&si6_addr), sizeof(si6_addr)) != 0)
+			throw(transient_exception(this->log.errno_string_error(errno, "UDP::thread_runner: bind")));
+
+		if(!this->multicast_group.empty())
+			this->multicast_open();
+
+		receive_buffer.reserve(this->mtu + 1);
+
+		for(;;)
+		{
+			nfds = 0;
+
+			pfd[nfds].fd = this->socket_fd;
+			pfd[nfds].events = POLLIN;
+			pfd[nfds].revents = 0;
+			nfds++;
+
+			if(this->multicast_fd >= 0)
 			{
-				this->stats["receive invalid packets"]++;
-				continue;
+				pfd[nfds].fd = this->multicast_fd;
+				pfd[nfds].events = POLLIN;
+				pfd[nfds].revents = 0;
+				nfds++;
 			}
 
-			if(!Packet::complete(receive_buffer))
+			rv = poll(pfd, nfds, this->poll_timeout());
+
+			if(rv < 0)
 			{
-				this->stats["receive incomplete packets"]++;
+				this->log.log_errno(errno, "udp: poll error");
+				this->stats_add("poll generic error");
 				continue;
 			}
 
-			command_response_t *command_response = new command_response_t;
-
-			static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr));
-			static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr_in));
-			static_assert(sizeof(command_response->ip.address.sin6_addr) >= sizeof(struct sockaddr_in6));
-
-			memcpy(&command_response->ip.address.sin6_addr, &si6_addr, si6_addr_length);
-			command_response->ip.address.sin6_length = si6_addr_length;
+			if(rv > 0)
+			{
+				if(pfd[0].revents & ~POLLIN)
+					throw(hard_exception("udp: socket error"));
 
-			command_response->source = cli_source_wlan_udp;
-			command_response->packetised = 1;
-			command_response->mtu = this->mtu;
-			command_response->packet = receive_buffer;
+				if((nfds > 1) && (pfd[1].revents & ~POLLIN))
+					throw(hard_exception("udp: multicast socket error"));
 
-			this->command->receive_queue_push(command_response);
+				if(pfd[0].revents & POLLIN)
+					this->socket_drain(this->socket_fd, receive_buffer, false);
 
-			command_response = nullptr;
+				if((nfds > 1) && (pfd[1].revents & POLLIN))
+					this->socket_drain(this->multicast_fd, receive_buffer, true);
+			}
 
-			this->stats["receive packets"]++;
+			this->housekeeping();
 		}
 
 		throw(hard_exception("loop breaks"));
@@ -189,8 +759,13 @@ void UDP::thread_runner()
 		(void)0;
 }
 
+// Replies to fragmented requests are sent as fragments when they do not fit in one fragment.
+// They are retained for sent_message_retain_ms so the client can request missing fragments.
+
 void UDP::send(const command_response_t *command_response)
 {
+	unsigned int index, count;
+	sent_message_t message;
 	int sent;
 
 	if(!command_response)
@@ -198,25 +773,116 @@ void UDP::send(const command_response_t *command_response)
 
 	if(this->socket_fd < 0)
 	{
-		this->stats["send no connection"]++;
+		this->stats_add("send no connection");
 		return;
 	}
 
-	sent = ::sendto(this->socket_fd, command_response->packet.data(), command_response->packet.length(), 0,
-			reinterpret_cast<const struct sockaddr *>(&command_response->ip.address.sin6_addr), command_response->ip.address.sin6_length);
+	if(command_response->ip.fragmented && (command_response->packet.length() > fragment_payload_size))
+	{
+		count = (command_response->packet.length() + fragment_payload_size - 1) / fragment_payload_size;
+
+		if(count > fragments_max)
+		{
+			this->stats_add("send fragments overflow");
+			return;
+		}
+
+		memcpy(&message.address, &command_response->ip.address.sin6_addr, std::min(static_cast<unsigned int>(sizeof(message.address)), command_response->ip.address.sin6_length));
+		message.address_length = command_response->ip.address.sin6_length;
+		message.packet = std::make_shared<const std::string>(command_response->packet);
+		message.time_sent = esp_timer_get_time();
+
+		{
+			std::scoped_lock lock(this->sent_messages_mutex);
+
+			while(!this->sent_messages.empty() && ((this->sent_messages.size() >= sent_messages_max) ||
+					((this->sent_messages_memory + message.packet->size()) > reassembly_memory_max)))
+			{
+				this->sent_messages_memory -= this->sent_messages.front().packet->size();
+				this->sent_messages.pop_front();
+			}
+
+			message.id = this->message_id_next++ & 0xffff;
+
+			this->sent_messages.push_back(message);
+			this->sent_messages_memory += message.packet->size();
+		}
+
+		for(index = 0; index < count; index++)
+			this->fragment_send(message, index);
+
+		this->stats_add("send packets fragmented");
+		return;
+	}
+
+	sent = UdpMulticast::reply(this->socket_fd, reinterpret_cast<const struct sockaddr *>(&command_response->ip.address.sin6_addr),
+			command_response->ip.address.sin6_length, command_response->packet);
 
 	if(sent <= 0)
 	{
-		this->stats["send errors"]++;
+		this->stats_add("send errors");
 		return;
 	}
 
+	std::scoped_lock lock(this->stats_mutex);
+
 	this->stats["send packets"]++;
 	this->stats["send bytes"] += sent;
 }
 
+// Replies that were queued back to back are sent from one wakeup of the send thread. They're not merged
+// into one datagram, because the client takes exactly one packet from each datagram.
+
+void UDP::send(const std::vector<command_response_t *> &command_responses)
+{
+	for(const auto *command_response : command_responses)
+		this->send(command_response);
+
+	this->stats_add("send batches");
+	this->stats_max("send batch max", command_responses.size());
+}
+
 void UDP::info(std::string &out)
 {
-	for(const auto &it : this->stats)
+	std::map<std::string, int> stats_copy;
+	unsigned int reassemblies_active, reassembly_memory_used, multicast_pending, completed_retained;
+	unsigned int sent_messages_retained, sent_messages_memory_used;
+	bool joined;
+
+	{
+		std::scoped_lock lock(this->stats_mutex);
+		stats_copy = this->stats;
+	}
+
+	{
+		std::scoped_lock lock(this->state_mutex);
+		reassemblies_active = this->reassemblies.size();
+		reassembly_memory_used = this->reassembly_memory;
+		completed_retained = this->completed.size();
+		joined = this->multicast_joined;
+	}
+
+	{
+		std::scoped_lock lock(this->sent_messages_mutex);
+		sent_messages_retained = this->sent_messages.size();
+		sent_messages_memory_used = this->sent_messages_memory;
+	}
+
+	multicast_pending = this->multicast_requests.pending();
+
+	for(const auto &it : stats_copy)
 		out += std::format("\n{:<32s} {:d}", it.first, it.second);
+
+	if(this->multicast_fd >= 0)
+		out += std::format("\nmulticast: group {}, port {:d}, {}, jitter {:d} ms, {:d} requests pending",
+				this->multicast_group, this->multicast_port, joined ? "joined" : "not joined",
+				this->multicast_requests.jitter(), multicast_pending);
+	else
+		out += "\nmulticast: disabled";
+
+	out += std::format("\nfragmentation: payload {:d} bytes, max {:d} fragments, reply mtu {:d}", fragment_payload_size, fragments_max, fragmented_mtu);
+	out += std::format("\n- reassembly: {:d} active, max {:d}, memory {:d} / {:d} bytes, {:d} recently completed",
+			reassemblies_active, reassemblies_max, reassembly_memory_used, reassembly_memory_max, completed_retained);
+	out += std::format("\n- retained replies: {:d}, max {:d}, memory {:d} / {:d} bytes",
+			sent_messages_retained, sent_messages_max, sent_messages_memory_used, reassembly_memory_max);
 }
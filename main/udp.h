@@ -1,10 +1,19 @@
 #pragma once
 
 #include "log.h"
+#include "config.h"
 #include "command-response.h"
+#include "udp-multicast.h"
 
 #include <string>
 #include <map>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+#include <netinet/in.h>
 
 class Command;
 
@@ -14,24 +23,129 @@ class UDP final
 
 		explicit UDP() = delete;
 		explicit UDP(const UDP &) = delete;
-		explicit UDP(Log &);
+		explicit UDP(Log &, Config &);
 
 		UDP &get();
 		void set(Command *);
 		void run();
 		void send(const command_response_t *);
+		void send(const std::vector<command_response_t *> &);
 		void info(std::string &);
 
 	private:
 
 		static constexpr int mtu = 16 * 1024; // emperically derived
+		static constexpr unsigned int receive_batch_max = 16;
+
+		// Fragments are datagrams that start with a header of fragment_header_size bytes:
+		// marker (1), type (1), message id (2), fragment index (2), fragment count (2), all little endian.
+		// A retransmit request has the same header, with the fragment index unused and the count set to
+		// the number of missing fragment indices (2 bytes each) following the header.
+
+		static constexpr unsigned int fragment_marker = 0x02;
+		static constexpr unsigned int fragment_type_data = 0;
+		static constexpr unsigned int fragment_type_retransmit = 1;
+		static constexpr unsigned int fragment_header_size = 8;
+		static constexpr unsigned int fragment_payload_size = 1400;
+		static constexpr unsigned int fragments_max = 64;
+		static constexpr int fragmented_mtu = 32 * 1024;
+		static constexpr unsigned int reassemblies_max = 4;
+		static constexpr unsigned int reassembly_memory_max = 128 * 1024;
+		static constexpr int reassembly_timeout_ms = 300;
+		static constexpr unsigned int reassembly_retransmits_max = 3;
+		static constexpr unsigned int sent_messages_max = 4;
+		static constexpr int sent_message_retain_ms = 2000;
+		static constexpr unsigned int completed_max = 16;
+		static constexpr int completed_retain_ms = 2000;
+		static constexpr int housekeeping_interval_ms = 100;
+
+		// Requests received on the multicast socket are held by UdpMulticast for a random time of up to
+		// the jitter before they're queued, so the replies of many devices are spread out.
+
+		static constexpr int multicast_port_default = 2424;
+		static constexpr int multicast_jitter_default_ms = 500;
+		static constexpr int multicast_join_retry_ms = 5000;
+		static constexpr unsigned int multicast_requests_max = 8;
+
+		struct reassembly_t
+		{
+			struct sockaddr_in6 address;
+			socklen_t address_length;
+			unsigned int id;
+			unsigned int count;
+			unsigned int received;
+			unsigned int bytes;
+			unsigned int retransmits;
+			std::vector<std::string> fragments;
+			std::int64_t time_updated;
+		};
+
+		struct sent_message_t
+		{
+			struct sockaddr_in6 address;
+			socklen_t address_length;
+			unsigned int id;
+			std::shared_ptr<const std::string> packet; // shared, so a message can be copied out and sent without holding the lock
+			std::int64_t time_sent;
+		};
+
+		// Recently completed reassemblies, so late duplicate fragments don't start a new one.
+
+		struct completed_t
+		{
+			struct sockaddr_in6 address;
+			socklen_t address_length;
+			unsigned int id;
+			std::int64_t time_completed;
+		};
+
+		// stats_mutex guards stats, which are updated from the udp thread and the send thread.
+		// state_mutex guards reassemblies, completed and multicast_joined. These are only changed by the
+		// udp thread, which takes the lock for that, other threads take it to read them. The multicast
+		// request queue has its own lock.
+		// sent_messages_mutex guards sent_messages and message_id_next.
 
 		static UDP *singleton;
 		Log &log;
+		Config &config;
 		Command *command;
 		int socket_fd;
+		int multicast_fd;
+		std::string multicast_group;
+		struct in6_addr multicast_address;
+		int multicast_port;
+		bool multicast_joined;
+		std::int64_t multicast_join_time;
+		UdpMulticast multicast_requests;
 		std::map<std::string, int> stats;
+		std::mutex stats_mutex;
 		bool running;
+		std::vector<reassembly_t> reassemblies;
+		unsigned int reassembly_memory;
+		std::deque<completed_t> completed;
+		std::mutex state_mutex;
+		std::deque<sent_message_t> sent_messages;
+		unsigned int sent_messages_memory;
+		std::mutex sent_messages_mutex;
+		unsigned int message_id_next;
 
+		static unsigned int get_le16(const std::string &data, unsigned int offset);
+		static void set_le16(std::string &data, unsigned int offset, unsigned int value);
+		static bool address_equal(const struct sockaddr_in6 &, socklen_t, const struct sockaddr_in6 &, socklen_t);
+		void stats_add(const char *name, int value = 1);
+		void stats_max(const char *name, int value);
+		void deliver(command_response_t *command_response, const struct sockaddr_in6 &address, socklen_t address_length, bool fragmented);
+		void datagram_receive(const std::string &datagram, const struct sockaddr_in6 &address, socklen_t address_length);
+		void socket_drain(int fd, std::string &receive_buffer, bool multicast);
+		void multicast_open();
+		void multicast_join();
+		void multicast_receive(const std::string &datagram, const struct sockaddr_in6 &address, socklen_t address_length);
+		void multicast_release();
+		int poll_timeout();
+		void fragment_receive(const std::string &datagram, const struct sockaddr_in6 &address, socklen_t address_length);
+		void fragment_send(const sent_message_t &message, unsigned int index);
+		static std::string retransmit_request(const reassembly_t &reassembly);
+		void retransmit_request_receive(const std::string &datagram, const struct sockaddr_in6 &address, socklen_t address_length);
+		void housekeeping();
 		[[noreturn]] void thread_runner();
 };
@@ -0,0 +1,113 @@
+#include "cli-parser.h"
+#include "exception.h"
+#include "bench.h"
+#include "binary-call.h"
+
+#include <string>
+#include <format>
+#include <iostream>
+
+// Throughput of the parse/validate stage: calls parsed per second for typical command lines,
+// in text form and in the equivalent binary form (see cli-parser.h).
+
+static const cli_parameters_description_t description_io_write =
+{
+	3,
+	{
+		{ cli_parameter_unsigned_int, 0, 1, 0, 0, "io", {}},
+		{ cli_parameter_unsigned_int, 0, 1, 0, 0, "pin", {}},
+		{ cli_parameter_unsigned_int, 0, 1, 0, 0, "value", {}},
+	}
+};
+
+static const cli_parameters_description_t description_fs_read =
+{
+	3,
+	{
+		{ cli_parameter_unsigned_int, 0, 1, 1, 1, "length", { .unsigned_int = { 0, 4096 }}},
+		{ cli_parameter_unsigned_int, 0, 1, 0, 0, "offset", {}},
+		{ cli_parameter_string_raw, 0, 1, 1, 1, "file", { .string = { 1, 64 }}},
+	}
+};
+
+static const cli_parameters_description_t description_display_brightness =
+{
+	1,
+	{
+		{ cli_parameter_unsigned_int, 0, 1, 1, 1, "brightness percentage", { .unsigned_int = { 0, 100 }}},
+	}
+};
+
+static double text(const char *name, const cli_parameters_description_t &description, const std::string &line, unsigned int iterations)
+{
+	cli_command_call_t call;
+	std::string command;
+
+	return(bench::run(std::format("text   {}", name), iterations, [&]()
+	{
+		std::string::const_iterator it;
+
+		it = CliParser::command(line, command);
+		CliParser::parameters(description, line, it, call);
+	}));
+}
+
+static double binary(const char *name, const cli_parameters_description_t &description, const std::string &line, unsigned int iterations)
+{
+	cli_command_call_t call;
+
+	return(bench::run(std::format("binary {}", name), iterations, [&]()
+	{
+		unsigned int offset;
+
+		CliParser::binary_command(line, offset);
+		CliParser::parameters_binary(description, line, offset, call);
+	}));
+}
+
+static void compare(const char *name, const cli_parameters_description_t &description, const std::string &text_line,
+		const std::string &binary_line, unsigned int iterations)
+{
+	double text_ns, binary_ns;
+
+	text_ns = text(name, description, text_line, iterations);
+	binary_ns = binary(name, description, binary_line, iterations);
+
+	std::cout << std::format("{:<40s} text {:d} bytes, binary {:d} bytes, binary {:.1f}x faster", name, text_line.size(), binary_line.size(),
+			binary_ns > 0 ? text_ns / binary_ns : 0) << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = bench::iterations(argc, argv, 1000000);
+	std::string io_write, fs_read, display_brightness;
+
+	// the command index is not looked at by the parser, any value will do
+
+	io_write = binary_header(1, 3);
+	put_unsigned_int(io_write, 1);
+	put_unsigned_int(io_write, 12);
+	put_unsigned_int(io_write, 1);
+
+	fs_read = binary_header(2, 3);
+	put_unsigned_int(fs_read, 4096);
+	put_unsigned_int(fs_read, 65536);
+	put_string(fs_read, "/littlefs/data/file.bin");
+
+	display_brightness = binary_header(3, 1);
+	put_unsigned_int(display_brightness, 50);
+
+	try
+	{
+		compare("io-write", description_io_write, "io-write 1 12 1", io_write, iterations);
+		compare("fs-read", description_fs_read, "fs-read 4096 65536 /littlefs/data/file.bin", fs_read, iterations);
+		compare("display-brightness", description_display_brightness, "db 50", display_brightness, iterations);
+	}
+	catch(const e32if_exception &e)
+	{
+		std::cerr << "bench-cli-parser: " << e.what() << std::endl;
+		return(1);
+	}
+
+	return(0);
+}
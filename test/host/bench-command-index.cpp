@@ -0,0 +1,81 @@
+#include "command-index.h"
+#include "commands.h"
+#include "bench.h"
+
+#include <string>
+#include <vector>
+#include <format>
+#include <iostream>
+
+// Dispatch cost: the compile-time sorted index used by Command::find_command against the linear scan
+// over the command table it replaced (two string compares per entry), for every name and alias and for a miss.
+
+static constexpr unsigned int index_size = CommandIndex::size(host_commands);
+static constexpr std::array<CommandIndex::entry_t, index_size> commands_index = CommandIndex::build<index_size>(host_commands);
+
+static_assert(CommandIndex::unique(commands_index), "host_commands: duplicate command name or alias");
+
+static int find_linear(const std::string &command)
+{
+	unsigned int ix;
+
+	for(ix = 0; host_commands[ix].name; ix++)
+	{
+		if(command == host_commands[ix].name)
+			return(ix);
+
+		if(host_commands[ix].alias && (command == host_commands[ix].alias))
+			return(ix);
+	}
+
+	return(-1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = bench::iterations(argc, argv, 1000000);
+	std::vector<std::string> names;
+	unsigned int ix, current;
+	int found;
+	double sorted_ns, linear_ns;
+
+	for(ix = 0; host_commands[ix].name; ix++)
+	{
+		names.push_back(host_commands[ix].name);
+
+		if(host_commands[ix].alias)
+			names.push_back(host_commands[ix].alias);
+	}
+
+	names.push_back("no-such-command");
+
+	for(const auto &name : names)
+	{
+		if(CommandIndex::find(commands_index, name) != find_linear(name))
+		{
+			std::cerr << std::format("bench-command-index: lookup mismatch for \"{}\"", name) << std::endl;
+			return(1);
+		}
+	}
+
+	std::cout << std::format("{:d} commands, {:d} names and aliases", ix, index_size) << std::endl;
+
+	found = 0;
+	current = 0;
+	sorted_ns = bench::run("sorted index", iterations, [&]()
+	{
+		found += CommandIndex::find(commands_index, names[current]);
+		current = (current + 1) % names.size();
+	});
+
+	current = 0;
+	linear_ns = bench::run("linear scan", iterations, [&]()
+	{
+		found += find_linear(names[current]);
+		current = (current + 1) % names.size();
+	});
+
+	std::cout << std::format("speedup {:.1f}x (checksum {:d})", sorted_ns > 0 ? linear_ns / sorted_ns : 0, found) << std::endl;
+
+	return(0);
+}
@@ -0,0 +1,179 @@
+#include "bench.h"
+
+#include <string>
+#include <vector>
+#include <format>
+#include <iostream>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/poll.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+// Receive cost over IPv6 loopback for a burst of request sized datagrams, comparing the receive loop
+// of main/udp.cpp before and after draining per wakeup:
+// - per datagram: poll, ioctl(FIONREAD), clear + resize, recvfrom, copy into a newly allocated request
+// - drain: one poll, then recvfrom with MSG_DONTWAIT into a buffer that keeps its allocation, until the socket
+//   is empty or the batch limit is reached, copy into a pooled request that keeps its capacity.
+// lwIP (and so the target) has no recvmmsg, the host uses plain recvfrom too.
+
+static constexpr int mtu = 16 * 1024;
+static constexpr unsigned int receive_batch_max = 16;
+static constexpr unsigned int datagram_size = 64;
+
+static int socket_bound(struct sockaddr_in6 &address)
+{
+	socklen_t length;
+	int fd;
+
+	if((fd = ::socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+		return(-1);
+
+	memset(&address, 0, sizeof(address));
+	address.sin6_family = AF_INET6;
+	address.sin6_addr = in6addr_loopback;
+	length = sizeof(address);
+
+	if((::bind(fd, reinterpret_cast<const struct sockaddr *>(&address), sizeof(address)) != 0) ||
+			(::getsockname(fd, reinterpret_cast<struct sockaddr *>(&address), &length) != 0))
+	{
+		::close(fd);
+		return(-1);
+	}
+
+	return(fd);
+}
+
+static void burst_send(int fd, const struct sockaddr_in6 &address, const std::string &datagram, unsigned int burst)
+{
+	unsigned int ix;
+
+	for(ix = 0; ix < burst; ix++)
+		::sendto(fd, datagram.data(), datagram.size(), 0, reinterpret_cast<const struct sockaddr *>(&address), sizeof(address));
+}
+
+static unsigned int receive_per_datagram(int fd, std::string &receive_buffer, unsigned int burst)
+{
+	struct sockaddr_in6 address;
+	socklen_t address_length;
+	struct pollfd pfd;
+	unsigned int received;
+	int length;
+
+	for(received = 0; received < burst; received++)
+	{
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if((::poll(&pfd, 1, 1000) <= 0) || ::ioctl(fd, FIONREAD, &length))
+			break;
+
+		receive_buffer.clear();
+		receive_buffer.resize(length);
+		address_length = sizeof(address);
+
+		if((length = ::recvfrom(fd, receive_buffer.data(), receive_buffer.size(), 0, reinterpret_cast<struct sockaddr *>(&address), &address_length)) <= 0)
+			break;
+
+		receive_buffer.resize(length);
+		delete new std::string(receive_buffer);
+	}
+
+	return(received);
+}
+
+static unsigned int receive_drain(int fd, std::string &receive_buffer, std::vector<std::string> &pool, unsigned int burst)
+{
+	struct sockaddr_in6 address;
+	socklen_t address_length;
+	struct pollfd pfd;
+	unsigned int received, batch;
+	int length;
+
+	for(received = 0; received < burst;)
+	{
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if(::poll(&pfd, 1, 1000) <= 0)
+			break;
+
+		for(batch = 0; batch < receive_batch_max; batch++)
+		{
+			address_length = sizeof(address);
+
+			receive_buffer.resize_and_overwrite(mtu + 1,
+					[&](char *data, std::size_t size)
+					{
+						length = ::recvfrom(fd, data, size, MSG_DONTWAIT, reinterpret_cast<struct sockaddr *>(&address), &address_length);
+						return((length > 0) ? length : 0);
+					});
+
+			if(length <= 0)
+				break;
+
+			pool[received % pool.size()].assign(receive_buffer);
+			received++;
+		}
+	}
+
+	return(received);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = bench::iterations(argc, argv, 20000);
+	struct sockaddr_in6 receive_address, send_address;
+	int receive_fd, send_fd;
+	std::string datagram(datagram_size, 'x');
+	std::string receive_buffer;
+	std::vector<std::string> pool(receive_batch_max);
+	unsigned int burst, lost;
+	double per_datagram_ns, drain_ns;
+
+	if(((receive_fd = socket_bound(receive_address)) < 0) || ((send_fd = socket_bound(send_address)) < 0))
+	{
+		std::cout << "bench-udp-receive: no IPv6 loopback, skipped" << std::endl;
+		return(0);
+	}
+
+	receive_buffer.reserve(mtu + 1);
+
+	for(auto &entry : pool)
+		entry.reserve(mtu);
+
+	for(burst = 1; burst <= receive_batch_max; burst *= 4)
+	{
+		lost = 0;
+
+		per_datagram_ns = bench::run(std::format("per datagram, burst of {:d}", burst), iterations, [&]()
+		{
+			burst_send(send_fd, receive_address, datagram, burst);
+			lost += burst - receive_per_datagram(receive_fd, receive_buffer, burst);
+		});
+
+		drain_ns = bench::run(std::format("drain, burst of {:d}", burst), iterations, [&]()
+		{
+			burst_send(send_fd, receive_address, datagram, burst);
+			lost += burst - receive_drain(receive_fd, receive_buffer, pool, burst);
+		});
+
+		std::cout << std::format("burst of {:d}: {:.0f} vs {:.0f} ns per datagram including send, drain {:.2f}x faster, {:d} lost",
+				burst, per_datagram_ns / burst, drain_ns / burst, drain_ns > 0 ? per_datagram_ns / drain_ns : 0, lost) << std::endl;
+
+		if(lost)
+		{
+			std::cerr << "bench-udp-receive: datagrams lost on loopback" << std::endl;
+			return(1);
+		}
+	}
+
+	::close(send_fd);
+	::close(receive_fd);
+
+	return(0);
+}
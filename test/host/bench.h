@@ -0,0 +1,40 @@
+#pragma once
+
+// Minimal timing helpers for the host benchmarks. The iteration count can be given as first argument,
+// the test target runs the benchmarks with a small count so they're built and exercised on every run.
+
+#include <chrono>
+#include <string>
+#include <format>
+#include <iostream>
+#include <cstdlib>
+
+namespace bench
+{
+	inline unsigned int iterations(int argc, char **argv, unsigned int default_iterations)
+	{
+		return((argc > 1) ? std::strtoul(argv[1], nullptr, 0) : default_iterations);
+	}
+
+	// Run function iterations times, print and return the time per call in nanoseconds.
+
+	template<typename F> double run(const std::string &name, unsigned int iterations, F function)
+	{
+		std::chrono::steady_clock::time_point start;
+		double elapsed_ns, per_call_ns;
+		unsigned int ix;
+
+		start = std::chrono::steady_clock::now();
+
+		for(ix = 0; ix < iterations; ix++)
+			function();
+
+		elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		per_call_ns = iterations ? elapsed_ns / iterations : 0;
+
+		std::cout << std::format("{:<40s} {:10d} calls {:10.1f} ns/call {:12.0f} calls/s", name, iterations, per_call_ns,
+				per_call_ns > 0 ? 1e9 / per_call_ns : 0) << std::endl;
+
+		return(per_call_ns);
+	}
+}
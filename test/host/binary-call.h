@@ -0,0 +1,52 @@
+#pragma once
+
+#include "cli-parser.h"
+
+#include <string>
+#include <bit>
+
+// Builders for binary calls, see cli-parser.h for the format.
+
+inline void put_le(std::string &out, unsigned int value, unsigned int size)
+{
+	unsigned int ix;
+
+	for(ix = 0; ix < size; ix++)
+		out.append(1, static_cast<char>((value >> (ix * 8)) & 0xff));
+}
+
+inline std::string binary_header(unsigned int command_index, unsigned int count)
+{
+	std::string out;
+
+	out.append(1, static_cast<char>(CliParser::binary_marker));
+	put_le(out, command_index, 2);
+	put_le(out, count, 1);
+
+	return(out);
+}
+
+inline void put_unsigned_int(std::string &out, unsigned int value)
+{
+	put_le(out, cli_parameter_unsigned_int, 1);
+	put_le(out, value, 4);
+}
+
+inline void put_signed_int(std::string &out, int value)
+{
+	put_le(out, cli_parameter_signed_int, 1);
+	put_le(out, static_cast<unsigned int>(value), 4);
+}
+
+inline void put_float(std::string &out, float value)
+{
+	put_le(out, cli_parameter_float, 1);
+	put_le(out, std::bit_cast<unsigned int>(value), 4);
+}
+
+inline void put_string(std::string &out, const std::string &value)
+{
+	put_le(out, cli_parameter_string, 1);
+	put_le(out, value.size(), 2);
+	out.append(value);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Minimal assertion helpers for the host tests, a failing check prints its location and the test exits non-zero.
+
+#include <iostream>
+#include <string>
+
+namespace check
+{
+	inline int failures = 0;
+
+	inline void fail(const char *file, int line, const std::string &text)
+	{
+		std::cerr << file << ":" << line << ": check failed: " << text << std::endl;
+		failures++;
+	}
+
+	inline int result(const char *name)
+	{
+		if(failures)
+			std::cerr << name << ": " << failures << " check(s) failed" << std::endl;
+		else
+			std::cout << name << ": all checks passed" << std::endl;
+
+		return(failures ? 1 : 0);
+	}
+}
+
+#define CHECK(expression) \
+	do { if(!(expression)) check::fail(__FILE__, __LINE__, #expression); } while(0)
+
+#define CHECK_THROWS(exception_type, statement) \
+	do \
+	{ \
+		bool thrown = false; \
+		try { statement; } catch(const exception_type &) { thrown = true; } catch(...) { } \
+		if(!thrown) check::fail(__FILE__, __LINE__, "expected " #exception_type " from: " #statement); \
+	} while(0)
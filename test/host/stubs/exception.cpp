@@ -0,0 +1,18 @@
+#include "exception.h"
+
+e32if_exception::e32if_exception(const std::string &what) : text(what)
+{
+}
+
+const char *e32if_exception::what() const noexcept
+{
+	return(this->text.c_str());
+}
+
+hard_exception::hard_exception(const std::string &what) : e32if_exception(what)
+{
+}
+
+transient_exception::transient_exception(const std::string &what) : e32if_exception(what)
+{
+}
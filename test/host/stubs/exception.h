@@ -0,0 +1,32 @@
+#pragma once
+
+// Host stand-in for the esp32-common exception classes, same interface as used by main/.
+
+#include <exception>
+#include <string>
+
+class e32if_exception : public std::exception
+{
+	public:
+
+		explicit e32if_exception(const std::string &what);
+		const char *what() const noexcept override;
+
+	private:
+
+		std::string text;
+};
+
+class hard_exception : public e32if_exception
+{
+	public:
+
+		explicit hard_exception(const std::string &what);
+};
+
+class transient_exception : public e32if_exception
+{
+	public:
+
+		explicit transient_exception(const std::string &what);
+};
@@ -0,0 +1,297 @@
+#include "cli-parser.h"
+#include "exception.h"
+#include "check.h"
+#include "binary-call.h"
+
+#include <string>
+#include <format>
+
+// Parse a text line (command + parameters) against a description, as run_receive_queue does.
+
+static std::string parse(const cli_parameters_description_t &description, const std::string &line, cli_command_call_t &call)
+{
+	std::string command;
+	std::string::const_iterator it;
+
+	it = CliParser::command(line, command);
+	CliParser::parameters(description, line, it, call);
+
+	return(command);
+}
+
+static const cli_parameters_description_t description_none = { 0, {} };
+
+static const cli_parameters_description_t description_mixed =
+{
+	4,
+	{
+		{ cli_parameter_unsigned_int, 0, 1, 1, 1, "unsigned", { .unsigned_int = { 1, 100 }}},
+		{ cli_parameter_signed_int, 0, 1, 1, 1, "signed", { .signed_int = { -10, 10 }}},
+		{ cli_parameter_float, 0, 1, 1, 1, "float", { .fp = { -1.5, 1.5 }}},
+		{ cli_parameter_string, 0, 0, 1, 1, "string", { .string = { 2, 4 }}},
+	}
+};
+
+static const cli_parameters_description_t description_unbounded =
+{
+	2,
+	{
+		{ cli_parameter_unsigned_int, 0, 1, 0, 0, "unsigned", {}},
+		{ cli_parameter_signed_int, 0, 0, 0, 0, "signed", {}},
+	}
+};
+
+static const cli_parameters_description_t description_hex =
+{
+	1,
+	{
+		{ cli_parameter_unsigned_int, 16, 1, 0, 0, "hex", {}},
+	}
+};
+
+static const cli_parameters_description_t description_raw =
+{
+	2,
+	{
+		{ cli_parameter_string, 0, 1, 0, 0, "name", {}},
+		{ cli_parameter_string_raw, 0, 1, 0, 1, "text", { .string = { 0, 24 }}},
+	}
+};
+
+static void test_command()
+{
+	std::string command;
+	std::string line;
+	std::string::const_iterator it;
+
+	line = "fs-list /littlefs";
+	it = CliParser::command(line, command);
+	CHECK(command == "fs-list");
+	CHECK(std::string(it, line.cend()) == " /littlefs");
+
+	line = "help";
+	it = CliParser::command(line, command);
+	CHECK(command == "help");
+	CHECK(it == line.cend());
+
+	line = "";
+	it = CliParser::command(line, command);
+	CHECK(command.empty());
+	CHECK(it == line.cend());
+
+	line = "info\tx";
+	CliParser::command(line, command);
+	CHECK(command == "info");
+}
+
+static void test_text_parameters()
+{
+	cli_command_call_t call;
+
+	CHECK(parse(description_mixed, "cmd 42 -3 0.5 abc", call) == "cmd");
+	CHECK(call.parameter_count == 4);
+	CHECK(call.parameters[0].has_value && (call.parameters[0].type == cli_parameter_unsigned_int) && (call.parameters[0].unsigned_int == 42));
+	CHECK(call.parameters[1].has_value && (call.parameters[1].type == cli_parameter_signed_int) && (call.parameters[1].signed_int == -3));
+	CHECK(call.parameters[2].has_value && (call.parameters[2].type == cli_parameter_float) && (call.parameters[2].fp == 0.5f));
+	CHECK(call.parameters[3].has_value && (call.parameters[3].type == cli_parameter_string) && (call.parameters[3].str == "abc"));
+
+	// any control character or space separates, runs of them count as one separator
+
+	parse(description_mixed, "cmd\t 7  \t-10\t1.5 ", call);
+	CHECK(call.parameter_count == 3);
+	CHECK(call.parameters[0].unsigned_int == 7);
+	CHECK(call.parameters[1].signed_int == -10);
+	CHECK(call.parameters[2].fp == 1.5f);
+	CHECK(!call.parameters[3].has_value);
+
+	// base 0 accepts hex and octal notation, fixed base 16 needs no prefix
+
+	parse(description_mixed, "cmd 0x10 -0x0a 0 ab", call);
+	CHECK(call.parameters[0].unsigned_int == 16);
+	CHECK(call.parameters[1].signed_int == -10);
+	parse(description_hex, "cmd ff", call);
+	CHECK(call.parameters[0].unsigned_int == 255);
+	parse(description_unbounded, "cmd 010", call);
+	CHECK(call.parameters[0].unsigned_int == 8);
+
+	// bounds
+
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 0 0 0", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 101 0 0", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 -11 0", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 11 0", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 0 1.6", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 0 -1.6", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 0 0 a", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 0 0 abcde", call));
+
+	// values that do not fit in 32 bits, on a 64 bit host as on the target
+
+	parse(description_unbounded, "cmd 4294967295 2147483647", call);
+	CHECK(call.parameters[0].unsigned_int == 4294967295U);
+	CHECK(call.parameters[1].signed_int == 2147483647);
+	parse(description_unbounded, "cmd 0 -2147483648", call);
+	CHECK(call.parameters[1].signed_int == -2147483647 - 1);
+	CHECK_THROWS(transient_exception, parse(description_unbounded, "cmd 4294967296", call));
+	CHECK_THROWS(transient_exception, parse(description_unbounded, "cmd -1", call));
+	CHECK_THROWS(transient_exception, parse(description_unbounded, "cmd 0 2147483648", call));
+	CHECK_THROWS(transient_exception, parse(description_unbounded, "cmd 0 -2147483649", call));
+	CHECK_THROWS(transient_exception, parse(description_unbounded, "cmd 99999999999999999999999", call));
+
+	// not a number
+
+	CHECK_THROWS(transient_exception, parse(description_unbounded, "cmd x", call));
+	CHECK_THROWS(transient_exception, parse(description_unbounded, "cmd 1 y", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 1 z", call));
+
+	// missing and superfluous parameters
+
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 1", call));
+	CHECK_THROWS(transient_exception, parse(description_mixed, "cmd 1 1 1 ab cd", call));
+	CHECK_THROWS(transient_exception, parse(description_none, "cmd x", call));
+
+	parse(description_none, "cmd", call);
+	CHECK(call.parameter_count == 0);
+	parse(description_none, "cmd  \t ", call);
+	CHECK(call.parameter_count == 0);
+
+	parse(description_unbounded, "cmd 5", call);
+	CHECK(call.parameter_count == 1);
+	CHECK(!call.parameters[1].has_value);
+}
+
+static void test_raw_string()
+{
+	cli_command_call_t call;
+
+	// a raw string takes the rest of the line including embedded white space
+
+	parse(description_raw, "alias ls  fs-list  /littlefs", call);
+	CHECK(call.parameter_count == 2);
+	CHECK(call.parameters[0].str == "ls");
+	CHECK(call.parameters[1].str == "fs-list  /littlefs");
+
+	CHECK_THROWS(transient_exception, parse(description_raw, "alias x 0123456789abcdef 012345678", call));
+	CHECK_THROWS(transient_exception, parse(description_raw, "alias x", call));
+}
+
+static void test_binary()
+{
+	cli_command_call_t call;
+	std::string line;
+	unsigned int offset;
+
+	line = binary_header(0x1234, 4);
+	put_unsigned_int(line, 100);
+	put_signed_int(line, -10);
+	put_float(line, -1.5f);
+	put_string(line, "abcd");
+
+	CHECK(CliParser::binary(line));
+	CHECK(!CliParser::binary("help"));
+	CHECK(!CliParser::binary(""));
+	CHECK(CliParser::binary_command(line, offset) == 0x1234);
+	CHECK(offset == 3);
+
+	CliParser::parameters_binary(description_mixed, line, offset, call);
+	CHECK(call.parameter_count == 4);
+	CHECK(call.parameters[0].unsigned_int == 100);
+	CHECK(call.parameters[1].signed_int == -10);
+	CHECK(call.parameters[2].fp == -1.5f);
+	CHECK(call.parameters[3].str == "abcd");
+
+	// optional parameters may be left out
+
+	line = binary_header(1, 3);
+	put_unsigned_int(line, 1);
+	put_signed_int(line, 0);
+	put_float(line, 0);
+	CliParser::binary_command(line, offset);
+	CliParser::parameters_binary(description_mixed, line, offset, call);
+	CHECK(call.parameter_count == 3);
+	CHECK(!call.parameters[3].has_value);
+
+	// same bounds as text
+
+	line = binary_header(1, 3);
+	put_unsigned_int(line, 101);
+	put_signed_int(line, 0);
+	put_float(line, 0);
+	CliParser::binary_command(line, offset);
+	CHECK_THROWS(transient_exception, CliParser::parameters_binary(description_mixed, line, offset, call));
+
+	// missing required parameter
+
+	line = binary_header(1, 2);
+	put_unsigned_int(line, 1);
+	put_signed_int(line, 0);
+	CliParser::binary_command(line, offset);
+	CHECK_THROWS(transient_exception, CliParser::parameters_binary(description_mixed, line, offset, call));
+
+	// too many parameters
+
+	line = binary_header(1, 5);
+	CliParser::binary_command(line, offset);
+	CHECK_THROWS(transient_exception, CliParser::parameters_binary(description_mixed, line, offset, call));
+
+	// type mismatch
+
+	line = binary_header(1, 1);
+	put_signed_int(line, 1);
+	CliParser::binary_command(line, offset);
+	CHECK_THROWS(transient_exception, CliParser::parameters_binary(description_unbounded, line, offset, call));
+
+	// a string can be passed for a raw string
+
+	line = binary_header(1, 2);
+	put_string(line, "ls");
+	put_string(line, "fs-list /");
+	CliParser::binary_command(line, offset);
+	CliParser::parameters_binary(description_raw, line, offset, call);
+	CHECK(call.parameters[1].str == "fs-list /");
+
+	// truncation anywhere and trailing bytes
+
+	line = binary_header(1, 4);
+	put_unsigned_int(line, 100);
+	put_signed_int(line, -10);
+	put_float(line, -1.5f);
+	put_string(line, "abcd");
+
+	for(unsigned int length = 0; length < line.size(); length++)
+	{
+		std::string truncated = line.substr(0, length);
+
+		try
+		{
+			CliParser::binary_command(truncated, offset);
+			CliParser::parameters_binary(description_mixed, truncated, offset, call);
+			check::fail(__FILE__, __LINE__, std::format("truncated binary call of {:d} bytes accepted", length));
+		}
+		catch(const transient_exception &)
+		{
+		}
+	}
+
+	line.append(1, 'x');
+	CliParser::binary_command(line, offset);
+	CHECK_THROWS(transient_exception, CliParser::parameters_binary(description_mixed, line, offset, call));
+}
+
+int main(int, char **)
+{
+	try
+	{
+		test_command();
+		test_text_parameters();
+		test_raw_string();
+		test_binary();
+	}
+	catch(const std::exception &e)
+	{
+		check::fail(__FILE__, __LINE__, std::format("unexpected exception: {}", e.what()));
+	}
+
+	return(check::result("test-cli-parser"));
+}
@@ -0,0 +1,327 @@
+#include "check.h"
+#include "udp-multicast.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <format>
+#include <iostream>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <unistd.h>
+
+// UdpMulticast from main/, first its request queue on its own, with the time and random numbers under control
+// of the test, then a multicast fan-out over the host's multicast loopback: every device has its unicast socket
+// and a multicast socket that joins the group, holds a request in its queue for a random time of up to the jitter
+// and then answers unicast from its unicast socket, like main/udp.cpp does.
+// One multicast request must reach every device and each must answer exactly once.
+
+static constexpr const char *group = "ff02::e32:2424";
+static constexpr unsigned int devices = 4;
+static constexpr unsigned int requests_max = 8;
+static constexpr int jitter_ms = 200;
+static constexpr int skipped = 77;
+
+struct device_t
+{
+	int unicast_fd;
+	int multicast_fd;
+	unsigned int port;
+};
+
+static std::int64_t now_us()
+{
+	return(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static unsigned int port_of(int fd)
+{
+	struct sockaddr_in6 address;
+	socklen_t length;
+
+	length = sizeof(address);
+
+	if(::getsockname(fd, reinterpret_cast<struct sockaddr *>(&address), &length) != 0)
+		return(0);
+
+	return(ntohs(address.sin6_port));
+}
+
+static void test_queue()
+{
+	UdpMulticast queue(requests_max, jitter_ms);
+	std::deque<UdpMulticast::request_t> due;
+	struct sockaddr_in6 address;
+	struct in6_addr group_address;
+	unsigned int ix;
+
+	memset(&address, 0, sizeof(address));
+	address.sin6_family = AF_INET6;
+
+	CHECK(UdpMulticast::group(group, group_address));
+	CHECK(!UdpMulticast::group("fe80::1", group_address));
+	CHECK(!UdpMulticast::group("not an address", group_address));
+
+	CHECK(queue.jitter() == jitter_ms);
+	CHECK(queue.timeout(0) == -1);
+
+	// the delay is the random number modulo (jitter + 1) milliseconds
+
+	CHECK(queue.push("a", address, sizeof(address), 1000000, 150));
+	CHECK(queue.push("b", address, sizeof(address), 1000000, jitter_ms + 1 + 50));
+	CHECK(queue.pending() == 2);
+	CHECK(queue.timeout(1000000) == 50);
+	CHECK(queue.timeout(1000000 + 49500) == 1);
+	CHECK(queue.timeout(1000000 + 60000) == 0);
+
+	queue.release(1000000 + 49999, due);
+	CHECK(due.empty());
+
+	queue.release(1000000 + 50000, due);
+	CHECK((due.size() == 1) && (due.front().packet == "b") && (due.front().address_length == sizeof(address)));
+	CHECK(queue.timeout(1000000 + 50000) == 100);
+
+	queue.release(1000000 + (jitter_ms * 1000), due);
+	CHECK((due.size() == 2) && (due.back().packet == "a"));
+	CHECK(queue.pending() == 0);
+	CHECK(queue.timeout(0) == -1);
+
+	// a full queue drops requests
+
+	for(ix = 0; ix < requests_max; ix++)
+		CHECK(queue.push(std::format("{:d}", ix), address, sizeof(address), 0, ix));
+
+	CHECK(!queue.push("dropped", address, sizeof(address), 0, 0));
+	CHECK(queue.pending() == requests_max);
+
+	// no jitter releases every request right away, in the order received
+
+	due.clear();
+	queue.jitter(-1);
+	CHECK(queue.jitter() == 0);
+	queue.release(jitter_ms * 1000, due);
+
+	CHECK(queue.push("now", address, sizeof(address), 5000, 12345));
+	CHECK(queue.timeout(5000) == 0);
+	queue.release(5000, due);
+
+	CHECK(due.size() == (requests_max + 1));
+
+	for(ix = 0; ix < requests_max; ix++)
+		CHECK(due[ix].packet == std::format("{:d}", ix));
+
+	CHECK(due.back().packet == "now");
+}
+
+static int receive(int fd, std::string &data, struct sockaddr_in6 &address, int timeout_ms)
+{
+	struct pollfd pfd;
+	socklen_t address_length;
+	char buffer[256];
+	int length;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if(::poll(&pfd, 1, timeout_ms) <= 0)
+		return(-1);
+
+	address_length = sizeof(address);
+
+	if((length = ::recvfrom(fd, buffer, sizeof(buffer), 0, reinterpret_cast<struct sockaddr *>(&address), &address_length)) < 0)
+		return(-1);
+
+	data.assign(buffer, length);
+
+	return(length);
+}
+
+static int client_open(unsigned int interface)
+{
+	int fd, loop = 1;
+
+	if((fd = UdpMulticast::open(0)) < 0)
+		return(-1);
+
+	::setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &interface, sizeof(interface));
+	::setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop));
+
+	return(fd);
+}
+
+static bool multicast_send(int fd, unsigned int interface, unsigned int port, const std::string &data)
+{
+	struct sockaddr_in6 address;
+
+	memset(&address, 0, sizeof(address));
+	address.sin6_family = AF_INET6;
+	address.sin6_port = htons(port);
+	address.sin6_scope_id = interface;
+	inet_pton(AF_INET6, group, &address.sin6_addr);
+
+	return(::sendto(fd, data.data(), data.size(), 0, reinterpret_cast<const struct sockaddr *>(&address), sizeof(address)) == static_cast<ssize_t>(data.size()));
+}
+
+// Not every host (or container) loops multicast back on every interface, find one that does.
+
+static unsigned int interface_find(const struct in6_addr &group_address)
+{
+	struct if_nameindex *interfaces, *it;
+	struct sockaddr_in6 address;
+	unsigned int interface;
+	std::string data;
+	int receiver, sender;
+
+	interface = 0;
+
+	if(!(interfaces = if_nameindex()))
+		return(0);
+
+	for(it = interfaces; it->if_index && !interface; it++)
+	{
+		if((receiver = UdpMulticast::open(0, true)) < 0)
+			continue;
+
+		if(UdpMulticast::join(receiver, group_address, it->if_index) && ((sender = client_open(it->if_index)) >= 0))
+		{
+			if(multicast_send(sender, it->if_index, port_of(receiver), "probe") && (receive(receiver, data, address, 200) > 0))
+				interface = it->if_index;
+
+			::close(sender);
+		}
+
+		::close(receiver);
+	}
+
+	if_freenameindex(interfaces);
+
+	return(interface);
+}
+
+static void device_run(const device_t &device, unsigned int id, unsigned int seed)
+{
+	UdpMulticast queue(requests_max, jitter_ms);
+	std::deque<UdpMulticast::request_t> due;
+	std::mt19937 random(seed);
+	struct sockaddr_in6 address;
+	std::string request;
+	int timeout;
+
+	if(receive(device.multicast_fd, request, address, 2000) <= 0)
+		return;
+
+	if(!queue.push(request, address, sizeof(address), now_us(), random()))
+		return;
+
+	while((timeout = queue.timeout(now_us())) >= 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		queue.release(now_us(), due);
+	}
+
+	for(const auto &it : due)
+		UdpMulticast::reply(device.unicast_fd, reinterpret_cast<const struct sockaddr *>(&it.address), it.address_length,
+				std::format("{:d}: {}", id, it.packet));
+}
+
+int main(int, char **)
+{
+	std::vector<device_t> fleet(devices);
+	std::vector<std::thread> threads;
+	std::set<unsigned int> replied, unicast_ports;
+	std::chrono::steady_clock::time_point start, first, last;
+	struct sockaddr_in6 address;
+	struct in6_addr group_address;
+	std::string reply;
+	unsigned int interface, multicast_port, ix, id;
+	int client;
+
+	test_queue();
+
+	CHECK(UdpMulticast::group(group, group_address));
+
+	if(!(interface = interface_find(group_address)))
+	{
+		std::cout << "test-udp-multicast: no interface with multicast loopback, fan-out skipped" << std::endl;
+		return(check::failures ? check::result("test-udp-multicast") : skipped);
+	}
+
+	multicast_port = 0;
+
+	for(ix = 0; ix < devices; ix++)
+	{
+		fleet[ix].unicast_fd = UdpMulticast::open(0);
+		fleet[ix].port = port_of(fleet[ix].unicast_fd);
+		fleet[ix].multicast_fd = UdpMulticast::open(multicast_port, true);
+		multicast_port = port_of(fleet[ix].multicast_fd);
+
+		CHECK(fleet[ix].unicast_fd >= 0);
+		CHECK(fleet[ix].multicast_fd >= 0);
+		CHECK(UdpMulticast::join(fleet[ix].multicast_fd, group_address, interface));
+
+		unicast_ports.insert(fleet[ix].port);
+	}
+
+	CHECK((client = client_open(interface)) >= 0);
+
+	for(ix = 0; ix < devices; ix++)
+		threads.emplace_back(device_run, std::cref(fleet[ix]), ix, std::random_device()());
+
+	start = std::chrono::steady_clock::now();
+	first = last = start;
+
+	CHECK(multicast_send(client, interface, multicast_port, "info"));
+
+	while(receive(client, reply, address, jitter_ms + 1000) > 0)
+	{
+		last = std::chrono::steady_clock::now();
+
+		if(replied.empty())
+			first = last;
+
+		id = std::stoul(reply);
+
+		CHECK(reply == std::format("{:d}: info", id));
+		CHECK(id < devices);
+		CHECK(!replied.contains(id));
+		CHECK(unicast_ports.contains(ntohs(address.sin6_port)));
+
+		replied.insert(id);
+
+		if(replied.size() == devices)
+			break;
+	}
+
+	for(auto &thread : threads)
+		thread.join();
+
+	CHECK(replied.size() == devices);
+
+	// replies are spread over the jitter window instead of all arriving at once
+
+	CHECK((last - start) <= std::chrono::milliseconds(jitter_ms + 500));
+	CHECK((last - first) >= std::chrono::milliseconds(1));
+
+	std::cout << std::format("test-udp-multicast: {:d} devices replied over {:d} ms", replied.size(),
+			std::chrono::duration_cast<std::chrono::milliseconds>(last - first).count()) << std::endl;
+
+	for(const auto &device : fleet)
+	{
+		::close(device.unicast_fd);
+		::close(device.multicast_fd);
+	}
+
+	::close(client);
+
+	return(check::result("test-udp-multicast"));
+}